@@ -0,0 +1,579 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "kif.hpp"
+#include "position.hpp"
+
+// Engine analysis of annotated KIFs as a column store. Every
+//
+//   **解析 0 ○ 候補1 時間 00:13.8 深さ 26/42 ノード数 28032697 評価値 -45 読み筋 ▲７八金(69) ...
+//
+// line becomes one row; the rows of each column are stored contiguously so
+// that corpus-wide scans touch only the columns they need. Rows are sorted
+// by game, then ply, then candidate. A .kifcol file holds:
+//
+//   Header
+//   uint32_t game[rows]      index into the game table
+//   uint16_t ply[rows]       moves played before the analysed position
+//   uint8_t  rank[rows]      候補 number, 1 when the line has none
+//   uint8_t  depth[rows], seldepth[rows]
+//   uint8_t  flags[rows]     Flag bits
+//   uint32_t timeMs[rows]
+//   uint64_t nodes[rows]
+//   int32_t  eval[rows]      sente's view in centipawns; a mate in n plies is ±(MATE - n)
+//   uint32_t pvOffset[rows + 1], Move pv[]       読み筋 as 16-bit move codes
+//   uint32_t pathOffset[games + 1], char paths[] game file paths
+//
+// each column padded to 8 bytes. The file is memory-mapped for reading.
+//
+// A 読み筋 move is a shogi::Move (to, from or dropped piece, promotion)
+// taken from the KIF text alone, and the words that may end a line get
+// codes of their own. That is 2 bytes where the text spends about 17, and
+// all the lines of a corpus fit in cache. Piece names are not stored;
+// pvText() recovers the text from the position the line starts from.
+
+namespace analysis {
+
+constexpr int32_t MATE = 100000;
+
+enum Flag : uint8_t {
+    FLAG_MATE = 1,
+    FLAG_LOWER = 2,       // 評価値 ending in ↑: a lower bound
+    FLAG_UPPER = 4,       // ↓: an upper bound
+    FLAG_MATCH_BEST = 8,  // ○: the move just played was the previous best candidate
+    FLAG_MATCH = 16,      // △: it was one of the other candidates
+};
+
+inline bool isMate(int32_t eval) { return eval >= MATE - 1000 || eval <= -(MATE - 1000); }
+
+// Sente's chance of winning at `eval` on a logistic curve with `scale`
+// centipawns per unit; mates come out at 0 or 1
+inline double winProbability(int32_t eval, double scale) { return 1 / (1 + std::exp(-eval / scale)); }
+
+// 読み筋 words that end a line in place of a move; bit 15 keeps them apart
+// from every shogi::Move. Engines differ in which side they mark the word
+// with, so PV_END_GOTE records a △.
+enum PvEnd : shogi::Move {
+    PV_RESIGN = 0x8000,  // 投了
+    PV_REPETITION,       // 千日手
+    PV_INFERIOR,         // 劣等局面
+    PV_SUPERIOR,         // 優等局面
+    PV_ENTERING_KING,    // 入玉勝ち
+    PV_END_GOTE = 0x100
+};
+
+inline bool isPvEnd(shogi::Move code) { return code & 0x8000; }
+inline PvEnd pvEnd(shogi::Move code) { return static_cast<PvEnd>(code & ~PV_END_GOTE); }
+
+// The moves of one 読み筋, iterated in order
+struct Pv {
+    const shogi::Move* first = nullptr;
+    const shogi::Move* last = nullptr;
+
+    const shogi::Move* begin() const { return first; }
+    const shogi::Move* end() const { return last; }
+    size_t size() const { return static_cast<size_t>(last - first); }
+    bool empty() const { return first == last; }
+    shogi::Move operator[](size_t i) const { return first[i]; }
+};
+
+// One parsed 解析 line; `pv` is the 読み筋 text and points into the line
+struct Line {
+    uint8_t rank = 1;
+    uint8_t depth = 0;
+    uint8_t seldepth = 0;
+    uint8_t flags = 0;
+    uint32_t timeMs = 0;
+    uint64_t nodes = 0;
+    int32_t eval = 0;
+    std::string_view pv;
+};
+
+namespace detail {
+
+inline bool startsWith(std::string_view s, std::string_view prefix) { return s.substr(0, prefix.size()) == prefix; }
+
+inline uint64_t number(std::string_view s) {
+    uint64_t n = 0;
+    for (char c : s) {
+        if (c < '0' || c > '9') break;
+        n = n * 10 + static_cast<uint64_t>(c - '0');
+    }
+    return n;
+}
+
+// "00:13.8" or "1:02:03.4" in milliseconds
+inline uint32_t milliseconds(std::string_view s) {
+    uint64_t whole = 0, field = 0, frac = 0, scale = 1000;
+    bool fraction = false;
+    for (char c : s) {
+        if (c == ':') {
+            whole = (whole + field) * 60;
+            field = 0;
+        } else if (c == '.') {
+            fraction = true;
+        } else if (c >= '0' && c <= '9') {
+            if (!fraction) {
+                field = field * 10 + static_cast<uint64_t>(c - '0');
+            } else if (scale > 1) {
+                scale /= 10;
+                frac += static_cast<uint64_t>(c - '0') * scale;
+            }
+        }
+    }
+    return static_cast<uint32_t>((whole + field) * 1000 + frac);
+}
+
+inline uint8_t clamp8(uint64_t n) { return static_cast<uint8_t>(n > 255 ? 255 : n); }
+
+// Text of each PvEnd code, from PV_RESIGN on
+inline constexpr std::string_view PV_END_WORDS[] = {
+    "\xE6\x8A\x95\xE4\xBA\x86",                                      // 投了
+    "\xE5\x8D\x83\xE6\x97\xA5\xE6\x89\x8B",                          // 千日手
+    "\xE5\x8A\xA3\xE7\xAD\x89\xE5\xB1\x80\xE9\x9D\xA2",              // 劣等局面
+    "\xE5\x84\xAA\xE7\xAD\x89\xE5\xB1\x80\xE9\x9D\xA2",              // 優等局面
+    "\xE5\x85\xA5\xE7\x8E\x89\xE5\x8B\x9D\xE3\x81\xA1",              // 入玉勝ち
+};
+
+// ▲ or △, the side marks in front of every 読み筋 token
+inline std::string_view sideMark(shogi::Color c) { return c == shogi::Sente ? "\xE2\x96\xB2" : "\xE2\x96\xB3"; }
+
+}  // namespace detail
+
+// The code of a KIF move, taken from its text alone: a move without a
+// from-square is a drop. False for 投了 and the other specials.
+inline bool moveCode(const kif::Move& km, shogi::Move& code) {
+    if (km.special() || km.to == 0) return false;
+    int to = shogi::square(km.to / 10, km.to % 10);
+    if (km.drop || km.from == 0) {
+        if (km.piece < kif::Pawn || km.piece > kif::Rook) return false;
+        code = shogi::makeDrop(km.piece, to);
+    } else {
+        code = shogi::makeMove(shogi::square(km.from / 10, km.from % 10), to, km.promote);
+    }
+    return true;
+}
+
+// Append the first `limit` moves of the 読み筋 `text` to `out` as codes.
+// `previous` is the move played just before the analysed position, for a
+// leading 同, or nullptr. The line is cut at the first token that is
+// neither a move nor a PvEnd word.
+inline void encodePv(std::string_view text, const kif::Move* previous, std::vector<shogi::Move>& out,
+                     size_t limit = SIZE_MAX) {
+    kif::Move last;
+    if (previous) last.to = previous->to;
+    size_t pos = 0;
+    for (size_t n = 0; n < limit && pos < text.size();) {
+        size_t end = text.find(' ', pos);
+        if (end == std::string_view::npos) end = text.size();
+        std::string_view token = text.substr(pos, end - pos);
+        pos = end + 1;
+        if (token.empty()) continue;
+        bool gote = detail::startsWith(token, detail::sideMark(shogi::Gote));
+        if (gote || detail::startsWith(token, detail::sideMark(shogi::Sente))) token.remove_prefix(3);
+        kif::Move km;
+        kif::detail::parseMove(kif::Encoding::Utf8, token, last.to ? &last : nullptr, km);
+        if (km.special()) {
+            const auto& words = detail::PV_END_WORDS;
+            auto it = std::find(std::begin(words), std::end(words), token);
+            if (it != std::end(words)) {
+                out.push_back(static_cast<shogi::Move>((PV_RESIGN + (it - std::begin(words))) | (gote ? PV_END_GOTE : 0)));
+            }
+            return;
+        }
+        shogi::Move code;
+        if (!moveCode(km, code)) return;
+        out.push_back(code);
+        ++n;
+        last = km;
+    }
+}
+
+// The KIF text of `pv` played out from `pos`, e.g. "▲７八金(69) △同　歩(77)",
+// with `pos` left as it was. `previousTo` is the square of the move played
+// into `pos` (for 同), or -1. Stops early at a move whose piece is missing.
+inline std::string pvText(shogi::Position& pos, Pv pv, int previousTo) {
+    static const std::string_view names[] = {
+        "", "\xE6\xAD\xA9", "\xE9\xA6\x99", "\xE6\xA1\x82", "\xE9\x8A\x80",  // 歩 香 桂 銀
+        "\xE9\x87\x91", "\xE8\xA7\x92", "\xE9\xA3\x9B", "\xE7\x8E\x89",        // 金 角 飛 玉
+        "\xE3\x81\xA8", "\xE6\x88\x90\xE9\xA6\x99", "\xE6\x88\x90\xE6\xA1\x82",  // と 成香 成桂
+        "\xE6\x88\x90\xE9\x8A\x80", "\xE9\xA6\xAC", "\xE9\xBE\x8D",           // 成銀 馬 龍
+    };
+    static const std::string_view files[] = {"", "\xEF\xBC\x91", "\xEF\xBC\x92", "\xEF\xBC\x93",
+                                             "\xEF\xBC\x94", "\xEF\xBC\x95", "\xEF\xBC\x96",
+                                             "\xEF\xBC\x97", "\xEF\xBC\x98", "\xEF\xBC\x99"};  // １-９
+    static const std::string_view ranks[] = {"", "\xE4\xB8\x80", "\xE4\xBA\x8C", "\xE4\xB8\x89",
+                                             "\xE5\x9B\x9B", "\xE4\xBA\x94", "\xE5\x85\xAD",
+                                             "\xE4\xB8\x83", "\xE5\x85\xAB", "\xE4\xB9\x9D"};  // 一-九
+    static const std::string_view SAME = "\xE5\x90\x8C\xE3\x80\x80",  // 同 and an ideographic space
+        PROMOTE = "\xE6\x88\x90", DROP = "\xE6\x89\x93";              // 成 打
+    std::string text;
+    size_t played = 0;
+    for (shogi::Move m : pv) {
+        if (!text.empty()) text += ' ';
+        if (isPvEnd(m)) {
+            text += detail::sideMark(m & PV_END_GOTE ? shogi::Gote : shogi::Sente);
+            text += detail::PV_END_WORDS[pvEnd(m) - PV_RESIGN];
+            break;
+        }
+        text += detail::sideMark(pos.side());
+        int to = shogi::moveTo(m);
+        if (to == previousTo) {
+            text += SAME;
+        } else {
+            text += files[shogi::fileOf(to)];
+            text += ranks[shogi::rankOf(to)];
+        }
+        if (shogi::isDrop(m)) {
+            text += names[shogi::dropPiece(m)];
+            text += DROP;
+        } else {
+            int from = shogi::moveFrom(m);
+            if (!(pos.occupied() & shogi::bit(from)) || pos.colorAt(from) != pos.side()) break;
+            text += names[pos.pieceAt(from)];
+            if (shogi::isPromotion(m)) text += PROMOTE;
+            text += '(';
+            text += static_cast<char>('0' + shogi::fileOf(from));
+            text += static_cast<char>('0' + shogi::rankOf(from));
+            text += ')';
+        }
+        pos.doMove(m);
+        ++played;
+        previousTo = to;
+    }
+    for (size_t i = played; i-- > 0;) pos.undoMove(pv[i]);
+    return text;
+}
+
+// Parse one UTF-8 "**解析" line. Returns false if it is not one or has no 評価値.
+inline bool parseLine(std::string_view text, Line& out) {
+    static const std::string_view ANALYSIS = "**\xE8\xA7\xA3\xE6\x9E\x90",        // **解析
+        CANDIDATE = "\xE5\x80\x99\xE8\xA3\x9C",                                   // 候補
+        TIME = "\xE6\x99\x82\xE9\x96\x93",                                        // 時間
+        DEPTH = "\xE6\xB7\xB1\xE3\x81\x95",                                       // 深さ
+        NODES = "\xE3\x83\x8E\xE3\x83\xBC\xE3\x83\x89\xE6\x95\xB0",               // ノード数
+        EVAL = "\xE8\xA9\x95\xE4\xBE\xA1\xE5\x80\xA4",                           // 評価値
+        PV = "\xE8\xAA\xAD\xE3\x81\xBF\xE7\xAD\x8B",                             // 読み筋
+        MATED = "\xE8\xA9\xB0",                                                   // 詰
+        BEST = "\xE2\x97\x8B", OTHER = "\xE2\x96\xB3",                            // ○ △
+        UP = "\xE2\x86\x91", DOWN = "\xE2\x86\x93";                               // ↑ ↓
+    out = Line();
+    if (!detail::startsWith(text, ANALYSIS)) return false;
+    size_t pos = ANALYSIS.size();
+    auto token = [&]() {
+        while (pos < text.size() && text[pos] == ' ') ++pos;
+        size_t end = text.find(' ', pos);
+        if (end == std::string_view::npos) end = text.size();
+        std::string_view t = text.substr(pos, end - pos);
+        pos = end;
+        return t;
+    };
+    token();  // engine number
+    bool hasEval = false;
+    for (std::string_view t = token(); !t.empty(); t = token()) {
+        if (t == BEST) {
+            out.flags |= FLAG_MATCH_BEST;
+        } else if (t == OTHER) {
+            out.flags |= FLAG_MATCH;
+        } else if (detail::startsWith(t, CANDIDATE)) {
+            out.rank = detail::clamp8(detail::number(t.substr(CANDIDATE.size())));
+        } else if (t == TIME) {
+            out.timeMs = detail::milliseconds(token());
+        } else if (t == DEPTH) {
+            std::string_view d = token();
+            size_t slash = d.find('/');
+            out.depth = detail::clamp8(detail::number(d));
+            if (slash != std::string_view::npos) out.seldepth = detail::clamp8(detail::number(d.substr(slash + 1)));
+        } else if (t == NODES) {
+            out.nodes = detail::number(token());
+        } else if (t == EVAL) {
+            std::string_view v = token();
+            int32_t sign = 1;
+            if (!v.empty() && (v[0] == '+' || v[0] == '-')) {
+                sign = v[0] == '-' ? -1 : 1;
+                v.remove_prefix(1);
+            }
+            if (detail::startsWith(v, MATED)) {
+                // "+詰 7": sente mates in 7 plies; the distance may be missing
+                size_t save = pos;
+                std::string_view n = token();
+                if (n.empty() || n[0] < '0' || n[0] > '9') {
+                    pos = save;
+                    n = {};
+                }
+                out.flags |= FLAG_MATE;
+                out.eval = sign * (MATE - static_cast<int32_t>(std::min<uint64_t>(detail::number(n), 999)));
+            } else {
+                out.eval = sign * static_cast<int32_t>(std::min<uint64_t>(detail::number(v), MATE - 1001));
+                if (v.find(UP) != std::string_view::npos) out.flags |= FLAG_LOWER;
+                if (v.find(DOWN) != std::string_view::npos) out.flags |= FLAG_UPPER;
+            }
+            hasEval = true;
+        } else if (t == PV) {
+            while (pos < text.size() && text[pos] == ' ') ++pos;
+            std::string_view rest = text.substr(pos);
+            while (!rest.empty() && (rest.back() == ' ' || rest.back() == '\r')) rest.remove_suffix(1);
+            out.pv = rest;
+            break;
+        }
+    }
+    if (out.rank == 0) out.rank = 1;
+    return hasEval;
+}
+
+// Call fn(ply, line) for every 解析 line of a parsed game, in file order.
+// CP932 comments are decoded into `buffer`, which the caller can reuse.
+template <typename Fn>
+void forEachLine(const kif::Record& record, std::string& buffer, Fn fn) {
+    auto scan = [&](uint16_t p, std::string_view comments) {
+        if (comments.empty()) return;
+        std::string_view text = record.text(comments, buffer);
+        size_t pos = 0;
+        Line line;
+        while (pos < text.size()) {
+            size_t end = text.find('\n', pos);
+            if (end == std::string_view::npos) end = text.size();
+            std::string_view l = text.substr(pos, end - pos);
+            pos = end + 1;
+            if (parseLine(l, line)) fn(p, line);
+        }
+    };
+    scan(0, record.comments);
+    for (size_t i = 0; i < record.moves.size(); ++i) scan(static_cast<uint16_t>(i + 1), record.moves[i].comments);
+}
+
+// Columns being assembled in memory
+struct Columns {
+    std::vector<uint32_t> game;
+    std::vector<uint16_t> ply;
+    std::vector<uint8_t> rank, depth, seldepth, flags;
+    std::vector<uint32_t> timeMs;
+    std::vector<uint64_t> nodes;
+    std::vector<int32_t> eval;
+    std::vector<uint32_t> pvOffset{0};
+    std::vector<shogi::Move> pv;
+    std::vector<uint32_t> pathOffset{0};
+    std::string paths;
+
+    size_t rows() const { return eval.size(); }
+
+    // `previous` is the move played before the analysed position, or nullptr
+    void add(uint32_t g, uint16_t p, const Line& line, const kif::Move* previous) {
+        game.push_back(g);
+        ply.push_back(p);
+        rank.push_back(line.rank);
+        depth.push_back(line.depth);
+        seldepth.push_back(line.seldepth);
+        flags.push_back(line.flags);
+        timeMs.push_back(line.timeMs);
+        nodes.push_back(line.nodes);
+        eval.push_back(line.eval);
+        encodePv(line.pv, previous, pv);
+        pvOffset.push_back(static_cast<uint32_t>(pv.size()));
+    }
+
+    // Add the analysis lines of a parsed game as game number `g`
+    void addGame(uint32_t g, const kif::Record& record) {
+        std::string buffer;
+        forEachLine(record, buffer, [&](uint16_t p, const Line& line) {
+            add(g, p, line, p > 0 ? &record.moves[p - 1] : nullptr);
+        });
+    }
+
+    // Append all rows of `other`, whose games are numbered from 0, after
+    // the games already here
+    void append(const Columns& other) {
+        uint32_t base = static_cast<uint32_t>(pathOffset.size() - 1);
+        for (uint32_t g : other.game) game.push_back(base + g);
+        ply.insert(ply.end(), other.ply.begin(), other.ply.end());
+        rank.insert(rank.end(), other.rank.begin(), other.rank.end());
+        depth.insert(depth.end(), other.depth.begin(), other.depth.end());
+        seldepth.insert(seldepth.end(), other.seldepth.begin(), other.seldepth.end());
+        flags.insert(flags.end(), other.flags.begin(), other.flags.end());
+        timeMs.insert(timeMs.end(), other.timeMs.begin(), other.timeMs.end());
+        nodes.insert(nodes.end(), other.nodes.begin(), other.nodes.end());
+        eval.insert(eval.end(), other.eval.begin(), other.eval.end());
+        uint32_t pvBase = static_cast<uint32_t>(pv.size());
+        for (size_t i = 1; i < other.pvOffset.size(); ++i) pvOffset.push_back(pvBase + other.pvOffset[i]);
+        pv.insert(pv.end(), other.pv.begin(), other.pv.end());
+        uint32_t pathBase = static_cast<uint32_t>(paths.size());
+        for (size_t i = 1; i < other.pathOffset.size(); ++i) pathOffset.push_back(pathBase + other.pathOffset[i]);
+        paths += other.paths;
+    }
+
+    void addPath(std::string_view path) {
+        paths.append(path);
+        pathOffset.push_back(static_cast<uint32_t>(paths.size()));
+    }
+};
+
+// Read-only view of a .kifcol file
+class Store {
+public:
+    static constexpr char MAGIC[8] = {'K', 'I', 'F', 'C', 'O', 'L', '0', '2'};
+
+    Store() = default;
+    Store(const Store&) = delete;
+    Store& operator=(const Store&) = delete;
+    ~Store() { close(); }
+
+    // Write `c` to `file` through a temporary file
+    static bool write(const Columns& c, const std::filesystem::path& file, std::string& error) {
+        Header h{};
+        std::memcpy(h.magic, MAGIC, sizeof(MAGIC));
+        h.rows = c.rows();
+        h.games = c.pathOffset.size() - 1;
+        h.pvMoves = c.pv.size();
+        h.pathBytes = c.paths.size();
+
+        std::filesystem::path tmp = file;
+        tmp += ".tmp";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            error = "cannot create " + tmp.string() + ": " + std::strerror(errno);
+            return false;
+        }
+        uint64_t written = 0;
+        auto put = [&](const void* data, size_t len) {
+            static const char zeros[8] = {};
+            const char* p = static_cast<const char*>(data);
+            size_t pad = (8 - (written + len) % 8) % 8;
+            written += len + pad;
+            for (int part = 0; part < 2; ++part) {
+                while (len > 0) {
+                    ssize_t n = ::write(fd, p, len);
+                    if (n <= 0) return false;
+                    p += n;
+                    len -= static_cast<size_t>(n);
+                }
+                p = zeros;
+                len = pad;
+            }
+            return true;
+        };
+        bool ok = put(&h, sizeof(h)) && put(c.game.data(), c.game.size() * 4) && put(c.ply.data(), c.ply.size() * 2) &&
+                  put(c.rank.data(), c.rank.size()) && put(c.depth.data(), c.depth.size()) &&
+                  put(c.seldepth.data(), c.seldepth.size()) && put(c.flags.data(), c.flags.size()) &&
+                  put(c.timeMs.data(), c.timeMs.size() * 4) && put(c.nodes.data(), c.nodes.size() * 8) &&
+                  put(c.eval.data(), c.eval.size() * 4) && put(c.pvOffset.data(), c.pvOffset.size() * 4) &&
+                  put(c.pv.data(), c.pv.size() * 2) && put(c.pathOffset.data(), c.pathOffset.size() * 4) &&
+                  put(c.paths.data(), c.paths.size());
+        ok = ::close(fd) == 0 && ok;
+        if (!ok || ::rename(tmp.c_str(), file.c_str()) != 0) {
+            error = "cannot write " + file.string() + ": " + std::strerror(errno);
+            ::unlink(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool open(const std::filesystem::path& file, std::string& error) {
+        close();
+        int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || ::fstat(fd, &st) != 0) {
+            error = "cannot open " + file.string() + ": " + std::strerror(errno);
+            if (fd >= 0) ::close(fd);
+            return false;
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        void* p = size_ >= sizeof(Header) ? ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            error = "cannot map " + file.string();
+            size_ = 0;
+            return false;
+        }
+        base_ = static_cast<const char*>(p);
+        const Header* h = reinterpret_cast<const Header*>(base_);
+        if (std::memcmp(h->magic, MAGIC, sizeof(MAGIC)) != 0 || layout(*h) != size_) {
+            error = file.string() + " is not a .kifcol file";
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (base_) ::munmap(const_cast<char*>(base_), size_);
+        base_ = nullptr;
+        size_ = 0;
+    }
+
+    size_t rows() const { return header().rows; }
+    size_t games() const { return header().games; }
+    const uint32_t* game() const { return column<uint32_t>(GAME); }
+    const uint16_t* ply() const { return column<uint16_t>(PLY); }
+    const uint8_t* rank() const { return column<uint8_t>(RANK); }
+    const uint8_t* depth() const { return column<uint8_t>(DEPTH); }
+    const uint8_t* seldepth() const { return column<uint8_t>(SELDEPTH); }
+    const uint8_t* flags() const { return column<uint8_t>(FLAGS); }
+    const uint32_t* timeMs() const { return column<uint32_t>(TIME); }
+    const uint64_t* nodes() const { return column<uint64_t>(NODES); }
+    const int32_t* eval() const { return column<int32_t>(EVAL); }
+
+    // The 読み筋 of a row; pvText() turns it back into KIF notation
+    Pv pv(size_t row) const {
+        const uint32_t* off = column<uint32_t>(PV_OFFSET);
+        const shogi::Move* moves = column<shogi::Move>(PV);
+        return {moves + off[row], moves + off[row + 1]};
+    }
+
+    std::string_view path(size_t g) const {
+        const uint32_t* off = column<uint32_t>(PATH_OFFSET);
+        return {column<char>(PATHS) + off[g], off[g + 1] - off[g]};
+    }
+
+private:
+    struct Header {
+        char magic[8];
+        uint64_t rows;
+        uint64_t games;
+        uint64_t pvMoves;
+        uint64_t pathBytes;
+        uint64_t reserved[3];
+    };
+
+    enum Column { GAME, PLY, RANK, DEPTH, SELDEPTH, FLAGS, TIME, NODES, EVAL, PV_OFFSET, PV, PATH_OFFSET, PATHS, COLUMNS };
+
+    // Byte offset of every column, and the file size at [COLUMNS]
+    static void offsets(const Header& h, uint64_t (&at)[COLUMNS + 1]) {
+        const uint64_t bytes[COLUMNS] = {h.rows * 4, h.rows * 2, h.rows, h.rows, h.rows, h.rows, h.rows * 4,
+                                         h.rows * 8, h.rows * 4, (h.rows + 1) * 4, h.pvMoves * 2, (h.games + 1) * 4,
+                                         h.pathBytes};
+        at[0] = sizeof(Header);
+        for (int k = 0; k < COLUMNS; ++k) at[k + 1] = (at[k] + bytes[k] + 7) / 8 * 8;
+    }
+
+    static uint64_t layout(const Header& h) {
+        uint64_t at[COLUMNS + 1];
+        offsets(h, at);
+        return at[COLUMNS];
+    }
+
+    const Header& header() const { return *reinterpret_cast<const Header*>(base_); }
+
+    template <typename T>
+    const T* column(Column k) const {
+        uint64_t at[COLUMNS + 1];
+        offsets(header(), at);
+        return reinterpret_cast<const T*>(base_ + at[k]);
+    }
+
+    const char* base_ = nullptr;
+    size_t size_ = 0;
+};
+
+}  // namespace analysis
@@ -0,0 +1,603 @@
+#include <iostream>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <array>
+#include <map>
+#include <thread>
+#include <chrono>
+#include <charconv>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include "parallel.hpp"
+#include "walker.hpp"
+#include "kif.hpp"
+#include "analysis.hpp"
+#include "manifest.hpp"
+#include "position_index.hpp"
+
+namespace fs = std::filesystem;
+
+enum class Mode { None, Extract, Swings, Classify, Match, Index, Lookup };
+
+struct Options {
+    Mode mode = Mode::None;
+    unsigned threads = 0;
+    int32_t minSwing = 500;
+    int32_t ply = 0;         // --lookup: position after this many moves
+    double scale = 600;      // centipawns per unit of the win-probability curve
+    double inaccuracy = 5;   // win percentage a move must lose to be an inaccuracy,
+    double mistake = 10;     // a mistake
+    double blunder = 20;     // or a blunder
+    std::vector<std::string> args;
+};
+
+// Every .kif below a folder, sorted
+std::vector<fs::path> listKifs(const fs::path& root) {
+    std::vector<fs::path> files;
+    std::vector<std::string> errors;
+    for (auto& path : listFiles(root, {1, -1}, errors)) {
+        if (path.extension() == ".kif") files.push_back(path);
+    }
+    for (const auto& error : errors) std::cerr << "Error: " << error << "\n";
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+// Collect the engine analysis of every .kif below a folder into a .kifcol store
+int extractAnalysis(const Options& opt) {
+    std::vector<fs::path> files = listKifs(opt.args[0]);
+
+    // Each file is parsed into its own columns; they are joined in path order
+    std::vector<analysis::Columns> parts(files.size());
+    std::vector<std::string> errors(files.size());
+    parallelFor(files.size(), opt.threads, [&](size_t i) {
+        kif::KifFile file;
+        kif::Record record;
+        if (!file.open(files[i], errors[i]) || !kif::parse(file.data(), record, errors[i])) return;
+        parts[i].addGame(0, record);
+        parts[i].addPath(files[i].string());
+    });
+
+    analysis::Columns all;
+    size_t failed = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (!errors[i].empty()) {
+            std::cerr << "Error: " << files[i].string() << ": " << errors[i] << "\n";
+            ++failed;
+        }
+        if (parts[i].pathOffset.size() > 1) all.append(parts[i]);
+    }
+    std::string error;
+    if (!analysis::Store::write(all, opt.args[1], error)) {
+        std::cerr << "Error: " << error << "\n";
+        return 1;
+    }
+    std::cout << "Stored " << all.rows() << " analysis lines of " << all.pathOffset.size() - 1 << " games in "
+              << opt.args[1] << " (" << fs::file_size(opt.args[1]) << " bytes)\n";
+    return failed == 0 ? 0 : 1;
+}
+
+// Every move after which candidate 1's evaluation moved by at least
+// opt.minSwing; evaluations are from sente's side
+int printSwings(const Options& opt) {
+    analysis::Store store;
+    std::string error;
+    if (!store.open(opt.args[0], error)) {
+        std::cerr << "Error: " << error << "\n";
+        return 1;
+    }
+    const uint32_t* game = store.game();
+    const uint16_t* ply = store.ply();
+    const uint8_t* rank = store.rank();
+    const int32_t* eval = store.eval();
+    size_t swings = 0;
+    size_t previous = SIZE_MAX;  // last candidate-1 row
+    for (size_t i = 0; i < store.rows(); ++i) {
+        if (rank[i] != 1) continue;
+        if (previous != SIZE_MAX && game[previous] == game[i] && ply[previous] + 1 == ply[i]) {
+            int64_t delta = static_cast<int64_t>(eval[i]) - eval[previous];
+            if (delta >= opt.minSwing || -delta >= opt.minSwing) {
+                std::cout << store.path(game[i]) << "\t" << ply[i] << "\t" << eval[previous] << "\t" << eval[i] << "\n";
+                ++swings;
+            }
+        }
+        previous = i;
+    }
+    std::cerr << swings << " moves with a swing of " << opt.minSwing << " or more\n";
+    return 0;
+}
+
+// Labels of a played move, from best to worst; the summary marks each move
+// with one character of LABEL_MARKS
+enum Label : uint8_t { Unrated, Best, Good, Inaccuracy, Mistake, Blunder, LABELS };
+const char LABEL_MARKS[] = "-o.imx";
+const char* const LABEL_NAMES[] = {"unrated", "best", "good", "inaccuracy", "mistake", "blunder"};
+
+// Per-thread state of --classify. Every buffer is kept from one game to the
+// next, so a worker stops allocating once they have grown to its largest
+// game, and no worker touches another's memory.
+struct Classifier {
+    struct Row {
+        size_t file, begin, end;  // summary row of files[file] in `out`
+    };
+
+    kif::KifFile file;
+    kif::Record record;
+    shogi::Position pos;
+    std::string buffer;              // decoded comments
+    std::string names;               // decoded player name
+    std::vector<int32_t> eval;       // candidate 1's evaluation at each ply
+    std::vector<shogi::Move> best;   // candidate 1's first move at each ply
+    std::vector<shogi::Move> pv;
+    std::string labels;
+    std::string out;
+    std::vector<Row> rows;
+    std::vector<std::pair<size_t, std::string>> errors;
+    size_t counts[LABELS] = {};
+};
+
+// Label every move of one game and append its summary row to w.out:
+// path, sente, gote, then for each side the number of best, good,
+// inaccurate, mistaken and blundered moves and the mean win percentage
+// lost per rated move, then one LABEL_MARKS character per move
+bool classifyGame(Classifier& w, const fs::path& path, const Options& opt, std::string& error) {
+    constexpr int32_t NO_EVAL = INT32_MIN;
+    if (!w.file.open(path, error) || !kif::parse(w.file.data(), w.record, error)) return false;
+    const kif::Record& record = w.record;
+    if (!w.pos.set(record, error)) return false;
+    const shogi::Color first = w.pos.side();
+
+    const size_t plies = record.moves.size();
+    w.eval.assign(plies + 1, NO_EVAL);
+    w.best.assign(plies + 1, 0);
+    analysis::forEachLine(record, w.buffer, [&](uint16_t p, const analysis::Line& line) {
+        if (line.rank != 1 || p > plies || w.eval[p] != NO_EVAL) return;
+        w.eval[p] = line.eval;
+        w.pv.clear();
+        analysis::encodePv(line.pv, p > 0 ? &record.moves[p - 1] : nullptr, w.pv, 1);
+        if (!w.pv.empty()) w.best[p] = w.pv[0];
+    });
+
+    size_t counts[2][LABELS] = {};
+    double lost[2] = {};
+    w.labels.clear();
+    for (size_t k = 1; k <= plies; ++k) {
+        shogi::Move played;
+        if (!analysis::moveCode(record.moves[k - 1], played)) break;
+        const int side = (first + k - 1) % 2;
+        Label label = Unrated;
+        if (w.eval[k - 1] != NO_EVAL && w.eval[k] != NO_EVAL) {
+            double before = analysis::winProbability(w.eval[k - 1], opt.scale);
+            double after = analysis::winProbability(w.eval[k], opt.scale);
+            double loss = std::max(0.0, side == shogi::Sente ? before - after : after - before) * 100;
+            lost[side] += loss;
+            label = played == w.best[k - 1] ? Best
+                    : loss >= opt.blunder   ? Blunder
+                    : loss >= opt.mistake   ? Mistake
+                    : loss >= opt.inaccuracy ? Inaccuracy
+                                             : Good;
+        }
+        ++counts[side][label];
+        ++w.counts[label];
+        w.labels += LABEL_MARKS[label];
+    }
+
+    w.out += path.string();
+    static const char* const players[2][2] = {{"\xE5\x85\x88\xE6\x89\x8B", "\xE4\xB8\x8B\xE6\x89\x8B"},   // 先手 下手
+                                              {"\xE5\xBE\x8C\xE6\x89\x8B", "\xE4\xB8\x8A\xE6\x89\x8B"}};  // 後手 上手
+    for (auto& keys : players) {
+        const std::string_view* name = record.find(keys[0]);
+        if (!name) name = record.find(keys[1]);
+        w.out += '\t';
+        if (name) w.out += record.text(*name, w.names);
+    }
+    for (int side = 0; side < 2; ++side) {
+        size_t rated = 0;
+        for (int l = Best; l < LABELS; ++l) {
+            w.out += '\t';
+            w.out += std::to_string(counts[side][l]);
+            rated += counts[side][l];
+        }
+        char mean[32];
+        std::snprintf(mean, sizeof(mean), "\t%.1f", rated ? lost[side] / rated : 0.0);
+        w.out += mean;
+    }
+    w.out += '\t';
+    w.out += w.labels;
+    w.out += '\n';
+    return true;
+}
+
+// Label every played move of every .kif below a folder from candidate 1's
+// evaluation before and after it, and write one summary row per game
+int classifyMoves(const Options& opt) {
+    std::vector<fs::path> files = listKifs(opt.args[0]);
+    std::vector<Classifier> workers(opt.threads);
+    parallelForWorkers(files.size(), opt.threads, [&](unsigned t, size_t i) {
+        Classifier& w = workers[t];
+        std::string error;
+        size_t begin = w.out.size();
+        if (classifyGame(w, files[i], opt, error)) {
+            w.rows.push_back({i, begin, w.out.size()});
+        } else {
+            w.out.resize(begin);
+            w.errors.emplace_back(i, error);
+        }
+    });
+
+    // Rows in path order, gathered from the workers
+    std::vector<std::pair<const Classifier*, const Classifier::Row*>> rows(files.size());
+    size_t counts[LABELS] = {}, failed = 0;
+    for (const Classifier& w : workers) {
+        for (const Classifier::Row& row : w.rows) rows[row.file] = {&w, &row};
+        for (const auto& e : w.errors) {
+            std::cerr << "Error: " << files[e.first].string() << ": " << e.second << "\n";
+            ++failed;
+        }
+        for (int l = 0; l < LABELS; ++l) counts[l] += w.counts[l];
+    }
+
+    const std::string& file = opt.args[1];
+    std::string tmp = file + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    auto put = [&](const char* p, size_t len) {
+        while (len > 0) {
+            ssize_t n = ::write(fd, p, len);
+            if (n <= 0) return false;
+            p += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    };
+    std::string header = "path\tsente\tgote";
+    for (const char* side : {"sente", "gote"}) {
+        for (int l = Best; l < LABELS; ++l) header += std::string("\t") + side + "_" + LABEL_NAMES[l];
+        header += std::string("\t") + side + "_loss";
+    }
+    header += "\tmoves\n";
+    bool ok = fd >= 0 && put(header.data(), header.size());
+    for (const auto& row : rows) {
+        if (ok && row.first) ok = put(row.first->out.data() + row.second->begin, row.second->end - row.second->begin);
+    }
+    if (fd >= 0) ok = ::close(fd) == 0 && ok;
+    if (!ok || ::rename(tmp.c_str(), file.c_str()) != 0) {
+        std::cerr << "Error: cannot write " << file << ": " << std::strerror(errno) << "\n";
+        ::unlink(tmp.c_str());
+        return 1;
+    }
+
+    std::cout << "Classified " << files.size() - failed << " games into " << file << ":";
+    for (int l = 0; l < LABELS; ++l) std::cout << (l ? ", " : " ") << counts[l] << " " << LABEL_NAMES[l];
+    std::cout << "\n";
+    return failed == 0 ? 0 : 1;
+}
+
+// Game phases for the match rates, judged on the position before a move
+enum Phase : uint8_t { Opening, Middlegame, Endgame, PHASES };
+const char* const PHASE_NAMES[] = {"opening", "middlegame", "endgame"};
+
+// Opening while no piece but pawns has been captured and nothing is
+// promoted; endgame once a king is in check or at least three squares of
+// its 3x3 neighbourhood are attacked; middlegame in between
+Phase phaseOf(const shogi::Position& pos) {
+    for (shogi::Color c : {shogi::Sente, shogi::Gote}) {
+        int king = pos.king(c);
+        if (king < 0) continue;
+        int attacked = 0;
+        for (int df = -1; df <= 1; ++df) {
+            for (int dr = -1; dr <= 1; ++dr) {
+                int f = shogi::fileOf(king) + df, r = shogi::rankOf(king) + dr;
+                if (f < 1 || f > 9 || r < 1 || r > 9) continue;
+                int sq = shogi::square(f, r);
+                if (!pos.attacked(sq, ~c)) continue;
+                if (sq == king) return Endgame;
+                ++attacked;
+            }
+        }
+        if (attacked >= 3) return Endgame;
+    }
+    for (shogi::Color c : {shogi::Sente, shogi::Gote}) {
+        for (shogi::Piece p = shogi::Lance; p <= shogi::Rook; p = static_cast<shogi::Piece>(p + 1)) {
+            if (pos.hand(c, p)) return Middlegame;
+        }
+        for (shogi::Piece p = shogi::ProPawn; p <= shogi::Dragon; p = static_cast<shogi::Piece>(p + 1)) {
+            if (pos.pieces(c, p)) return Middlegame;
+        }
+    }
+    return Opening;
+}
+
+// Moves of one group and how many matched the engine's candidates
+struct MatchTally {
+    uint64_t games = 0;
+    uint64_t moves[PHASES] = {}, top1[PHASES] = {}, top3[PHASES] = {};
+
+    MatchTally& operator+=(const MatchTally& o) {
+        games += o.games;
+        for (int p = 0; p < PHASES; ++p) {
+            moves[p] += o.moves[p];
+            top1[p] += o.top1[p];
+            top3[p] += o.top3[p];
+        }
+        return *this;
+    }
+};
+
+// Per-thread state of --match: reused buffers, as in Classifier, and the
+// thread's own roll-ups, merged once every file has been read
+struct Matcher {
+    kif::KifFile file;
+    kif::Record record;
+    shogi::Position pos;
+    std::string buffer;
+    std::vector<std::array<shogi::Move, 3>> candidates;  // first move of 候補1-3 at each ply, 0 if none
+    std::vector<shogi::Move> pv;
+    std::map<std::string, MatchTally> players, controls, months;
+    std::vector<std::pair<size_t, std::string>> errors;
+};
+
+// Compare every played move of one game with the candidates analysed in
+// the position before it, and add the game to w's roll-ups
+bool matchGame(Matcher& w, const fs::path& path, std::string& error) {
+    if (!w.file.open(path, error) || !kif::parse(w.file.data(), w.record, error)) return false;
+    const kif::Record& record = w.record;
+    if (!w.pos.set(record, error)) return false;
+
+    const size_t plies = record.moves.size();
+    w.candidates.assign(plies + 1, {});
+    analysis::forEachLine(record, w.buffer, [&](uint16_t p, const analysis::Line& line) {
+        if (p > plies || line.rank < 1 || line.rank > 3) return;
+        w.pv.clear();
+        analysis::encodePv(line.pv, p > 0 ? &record.moves[p - 1] : nullptr, w.pv, 1);
+        if (!w.pv.empty() && !w.candidates[p][line.rank - 1]) w.candidates[p][line.rank - 1] = w.pv[0];
+    });
+
+    MatchTally sides[2];
+    sides[0].games = sides[1].games = 1;
+    for (size_t k = 0; k < plies; ++k) {
+        const kif::Move& km = record.moves[k];
+        if (km.special()) break;
+        const auto& c = w.candidates[k];
+        if (c[0]) {
+            shogi::Move played = 0;
+            analysis::moveCode(km, played);
+            MatchTally& t = sides[w.pos.side()];
+            Phase phase = phaseOf(w.pos);
+            ++t.moves[phase];
+            t.top1[phase] += played == c[0];
+            t.top3[phase] += played == c[0] || played == c[1] || played == c[2];
+        }
+        shogi::Move m;
+        if (!w.pos.doKifMove(km, m, error)) return false;
+    }
+
+    // 先手/下手 and 後手/上手 name the players; 持ち時間, or failing that
+    // 棋戦, the time control; 開始日時 the month
+    auto field = [&](const char* key, const char* alternative) {
+        const std::string_view* v = record.find(key);
+        if (!v && alternative) v = record.find(alternative);
+        return v ? std::string(record.text(*v, w.buffer)) : std::string();
+    };
+    std::string first = manifest::playerName(field("\xE5\x85\x88\xE6\x89\x8B", "\xE4\xB8\x8B\xE6\x89\x8B"));
+    std::string second = manifest::playerName(field("\xE5\xBE\x8C\xE6\x89\x8B", "\xE4\xB8\x8A\xE6\x89\x8B"));
+    std::string control = field("\xE6\x8C\x81\xE3\x81\xA1\xE6\x99\x82\xE9\x96\x93", nullptr);
+    if (control.empty()) control = field("\xE6\xA3\x8B\xE6\x88\xA6", nullptr);
+    uint32_t date = manifest::parseDate(field("\xE9\x96\x8B\xE5\xA7\x8B\xE6\x97\xA5\xE6\x99\x82", nullptr));
+    char month[16] = "-";
+    if (date) std::snprintf(month, sizeof(month), "%04u-%02u", date / 10000, date / 100 % 100);
+
+    MatchTally both = sides[0];
+    both += sides[1];
+    both.games = 1;
+    w.players[first.empty() ? "-" : first] += sides[0];
+    w.players[second.empty() ? "-" : second] += sides[1];
+    w.controls[control.empty() ? "-" : control] += both;
+    w.months[month] += both;
+    return true;
+}
+
+// Recompute the 一致率 of every .kif below a folder and print it per
+// player, time control and month, overall and per phase
+int printMatchRates(const Options& opt) {
+    std::vector<fs::path> files = listKifs(opt.args[0]);
+    std::vector<Matcher> workers(opt.threads);
+    parallelForWorkers(files.size(), opt.threads, [&](unsigned t, size_t i) {
+        std::string error;
+        if (!matchGame(workers[t], files[i], error)) workers[t].errors.emplace_back(i, error);
+    });
+
+    std::map<std::string, MatchTally> groups[3];
+    size_t failed = 0;
+    for (Matcher& w : workers) {
+        for (const auto& e : w.errors) {
+            std::cerr << "Error: " << files[e.first].string() << ": " << e.second << "\n";
+            ++failed;
+        }
+        int g = 0;
+        for (auto* rollup : {&w.players, &w.controls, &w.months}) {
+            for (const auto& [key, tally] : *rollup) groups[g][key] += tally;
+            ++g;
+        }
+    }
+
+    auto percent = [](uint64_t n, uint64_t d) {
+        char s[16];
+        std::snprintf(s, sizeof(s), "%.1f", d ? 100.0 * n / d : 0.0);
+        return std::string(s);
+    };
+    std::cout << "group\tkey\tgames\tmoves\ttop1\ttop3";
+    for (const char* phase : PHASE_NAMES) std::cout << "\t" << phase << "_moves\t" << phase << "_top1\t" << phase << "_top3";
+    std::cout << "\n";
+    const char* const names[] = {"player", "control", "month"};
+    for (int g = 0; g < 3; ++g) {
+        for (const auto& [key, t] : groups[g]) {
+            uint64_t moves = 0, top1 = 0, top3 = 0;
+            for (int p = 0; p < PHASES; ++p) {
+                moves += t.moves[p];
+                top1 += t.top1[p];
+                top3 += t.top3[p];
+            }
+            std::cout << names[g] << "\t" << key << "\t" << t.games << "\t" << moves << "\t" << percent(top1, moves) << "\t"
+                      << percent(top3, moves);
+            for (int p = 0; p < PHASES; ++p) {
+                std::cout << "\t" << t.moves[p] << "\t" << percent(t.top1[p], t.moves[p]) << "\t"
+                          << percent(t.top3[p], t.moves[p]);
+            }
+            std::cout << "\n";
+        }
+    }
+    return failed == 0 ? 0 : 1;
+}
+
+// Add every .kif below a folder that its position index does not have yet
+int indexPositions(const Options& opt) {
+    const fs::path root = opt.args[0];
+    std::vector<std::string> paths;
+    for (const auto& path : listKifs(root)) paths.push_back(path.lexically_relative(root).string());
+    PositionIndex index;
+    PositionIndex::UpdateStats stats;
+    std::string error;
+    // The walk lists every game, so a damaged index is rebuilt from it
+    fs::path file = PositionIndex::pathFor(root);
+    if (fs::exists(file) && !index.open(root, error)) {
+        std::cerr << "Rebuilding damaged " << file.string() << "\n";
+        fs::remove(file);
+        error.clear();
+    }
+    if (!index.update(root, paths, opt.threads, stats, error)) {
+        std::cerr << "Error: " << error << "\n";
+        return 1;
+    }
+    for (const auto& e : stats.errors) std::cerr << "Error: " << e << "\n";
+    std::cout << "Indexed " << stats.added << " new games (" << stats.entries << " positions, " << stats.runs
+              << " runs spilled): " << index.games() << " games and " << index.keys() << " distinct positions in "
+              << PositionIndex::pathFor(root).string() << " (" << index.bytes() << " bytes)\n";
+    return stats.errors.empty() ? 0 : 1;
+}
+
+// Every game in the index of a folder that reached the position after
+// `ply` moves of a given game, and the move played next there
+int lookupPosition(const Options& opt) {
+    const fs::path root = opt.args[0];
+    const int ply = opt.ply;
+    kif::KifFile file;
+    kif::Record record;
+    shogi::Position pos;
+    std::vector<shogi::Move> moves;
+    std::vector<uint64_t> keys;
+    std::string error;
+    if (!file.open(opt.args[1], error) || !kif::parse(file.data(), record, error) ||
+        !shogi::replay(record, pos, moves, keys, error)) {
+        std::cerr << "Error: " << opt.args[1] << ": " << error << "\n";
+        return 1;
+    }
+    if (ply < 0 || static_cast<size_t>(ply) >= keys.size()) {
+        std::cerr << "Error: " << opt.args[1] << " has " << moves.size() << " moves\n";
+        return 1;
+    }
+    PositionIndex index;
+    if (!index.open(root, error)) {
+        std::cerr << "Error: " << error << "\n";
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<PositionIndex::Posting> hits;
+    for (PositionIndex::Posting p : index.find(keys[ply])) hits.push_back(p);
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    for (const PositionIndex::Posting& hit : hits) {
+        std::string path(index.path(hit.game));
+        std::string next = "-";
+        if (file.open(root / path, error) && kif::parse(file.data(), record, error) && hit.ply < record.moves.size()) {
+            next = record.text(record.moves[hit.ply].text);
+        }
+        std::cout << path << "\t" << hit.ply << "\t" << next << "\n";
+    }
+    std::cerr << hits.size() << " occurrences (lookup " << us << " us)\n";
+    return 0;
+}
+
+// A decimal that fills the whole argument and fits in 32 bits
+bool parseInt(const char* text, int32_t& value) {
+    const char* end = text + std::strlen(text);
+    auto [ptr, ec] = std::from_chars(text, end, value);
+    return ec == std::errc() && ptr == end;
+}
+
+bool parseArgs(int argc, char* argv[], Options& opt) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--extract") {
+            opt.mode = Mode::Extract;
+        } else if (arg == "--swings") {
+            opt.mode = Mode::Swings;
+        } else if (arg == "--classify") {
+            opt.mode = Mode::Classify;
+        } else if (arg == "--match") {
+            opt.mode = Mode::Match;
+        } else if (arg == "--index") {
+            opt.mode = Mode::Index;
+        } else if (arg == "--lookup") {
+            opt.mode = Mode::Lookup;
+        } else if (arg == "--scale" && i + 1 < argc) {
+            opt.scale = std::atof(argv[++i]);
+        } else if (arg == "--inaccuracy" && i + 1 < argc) {
+            opt.inaccuracy = std::atof(argv[++i]);
+        } else if (arg == "--mistake" && i + 1 < argc) {
+            opt.mistake = std::atof(argv[++i]);
+        } else if (arg == "--blunder" && i + 1 < argc) {
+            opt.blunder = std::atof(argv[++i]);
+        } else if (arg == "--min" && i + 1 < argc) {
+            if (!parseInt(argv[++i], opt.minSwing)) return false;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            if (!parseCount(argv[++i], opt.threads)) return false;
+        } else if (arg.rfind("--", 0) == 0) {
+            return false;
+        } else {
+            opt.args.push_back(arg);
+        }
+    }
+    if (opt.threads == 0) opt.threads = std::max(1u, std::thread::hardware_concurrency());
+    switch (opt.mode) {
+        case Mode::Extract: return opt.args.size() == 2 && fs::is_directory(opt.args[0]);
+        case Mode::Swings: return opt.args.size() == 1 && opt.minSwing > 0;
+        case Mode::Classify:
+            return opt.args.size() == 2 && fs::is_directory(opt.args[0]) && opt.scale > 0 && opt.inaccuracy > 0 &&
+                   opt.inaccuracy <= opt.mistake && opt.mistake <= opt.blunder;
+        case Mode::Match: return opt.args.size() == 1 && fs::is_directory(opt.args[0]);
+        case Mode::Index: return opt.args.size() == 1 && fs::is_directory(opt.args[0]);
+        case Mode::Lookup: return opt.args.size() == 3 && parseInt(opt.args[2].c_str(), opt.ply) && opt.ply >= 0;
+        default: return false;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    if (!parseArgs(argc, argv, opt)) {
+        std::cerr << "Usage: analyze_kif --extract [--threads N] <folder> <store.kifcol>\n"
+                  << "       analyze_kif --swings [--min CENTIPAWNS] <store.kifcol>\n"
+                  << "       analyze_kif --classify [--threads N] [--scale CENTIPAWNS] [--inaccuracy PERCENT]\n"
+                  << "                   [--mistake PERCENT] [--blunder PERCENT] <folder> <summary.tsv>\n"
+                  << "       analyze_kif --match [--threads N] <folder>\n"
+                  << "       analyze_kif --index [--threads N] <folder>\n"
+                  << "       analyze_kif --lookup <folder> <game.kif> <ply>\n";
+        return 1;
+    }
+    switch (opt.mode) {
+        case Mode::Extract: return extractAnalysis(opt);
+        case Mode::Swings: return printSwings(opt);
+        case Mode::Classify: return classifyMoves(opt);
+        case Mode::Match: return printMatchRates(opt);
+        case Mode::Index: return indexPositions(opt);
+        case Mode::Lookup: return lookupPosition(opt);
+        default: return 1;
+    }
+}
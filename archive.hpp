@@ -0,0 +1,204 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <filesystem>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "tar.hpp"
+#include "rules.hpp"
+#include "manifest.hpp"
+#include "move_plan.hpp"
+
+// Routes the games inside a .tar archive without extracting it first. The
+// archive is read once, front to back; each member is held in memory only
+// while it is matched (header rules see the member's bytes, not a file) and
+// written under a temporary name straight into its target directory, then
+// renamed into place with RENAME_NOREPLACE. Instead of one fsync per game,
+// every target filesystem is synced once at the end, so the archive is only
+// safe to delete after importArchive returns without errors.
+
+namespace archive {
+
+// Members above this size are not games; they are skipped with an error
+constexpr uint64_t MAX_MEMBER_BYTES = 64ull << 20;
+
+inline bool isTar(const std::string& name) {
+    return name.size() > 4 && name.compare(name.size() - 4, 4, ".tar") == 0;
+}
+
+// Whether dstFd/name is a regular file holding exactly `data`
+inline bool sameContent(int dstFd, const std::string& name, std::string_view data) {
+    struct stat st;
+    if (::fstatat(dstFd, name.c_str(), &st, 0) != 0 || !S_ISREG(st.st_mode) ||
+        static_cast<uint64_t>(st.st_size) != data.size()) {
+        return false;
+    }
+    int in = ::openat(dstFd, name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) return false;
+    char buf[1 << 16];
+    bool same = true;
+    while (same && !data.empty()) {
+        ssize_t n = ::read(in, buf, std::min(sizeof(buf), data.size()));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            same = false;
+            break;
+        }
+        same = std::memcmp(buf, data.data(), static_cast<size_t>(n)) == 0;
+        data.remove_prefix(static_cast<size_t>(n));
+    }
+    ::close(in);
+    return same;
+}
+
+// Write `data` to dstFd/name through a temporary file, without replacing
+// an existing file and without syncing. A target that already holds the
+// same bytes (left by an earlier, interrupted import) is not an error;
+// `existed` tells the caller it was not written now.
+inline bool writeMember(int dstFd, const std::string& name, const TarEntry& entry, std::string_view data,
+                        const std::filesystem::path& target, bool& existed, std::string& error) {
+    existed = sameContent(dstFd, name, data);
+    if (existed) return true;
+    std::string tmp = "." + name + ".kifmove-" + std::to_string(::getpid());
+    mode_t mode = (entry.mode & 0777) ? (entry.mode & 0777) : 0644;
+    int out = ::openat(dstFd, tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+    if (out < 0) {
+        error = "Could not create " + target.string() + ": " + std::strerror(errno);
+        return false;
+    }
+    int err = 0;
+    for (std::string_view rest = data; !rest.empty();) {
+        ssize_t n = ::write(out, rest.data(), rest.size());
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            err = n < 0 ? errno : EIO;
+            break;
+        }
+        rest.remove_prefix(static_cast<size_t>(n));
+    }
+    if (err == 0) {
+        struct timespec times[2] = {{0, UTIME_OMIT}, {static_cast<time_t>(entry.mtime), 0}};
+        ::futimens(out, times);
+    }
+    if (::close(out) != 0 && err == 0) err = errno;
+    if (err == 0 && ::renameat2(dstFd, tmp.c_str(), dstFd, name.c_str(), RENAME_NOREPLACE) != 0) err = errno;
+    if (err != 0) {
+        ::unlinkat(dstFd, tmp.c_str(), 0);
+        if (err == EEXIST && sameContent(dstFd, name, data)) {
+            existed = true;
+            return true;
+        }
+        error = err == EEXIST ? "Target already exists, skipping: " + target.string()
+                              : "Could not write " + target.string() + ": " + std::strerror(err);
+        return false;
+    }
+    return true;
+}
+
+}  // namespace archive
+
+// Route every regular member of `path` by its file name (directories in the
+// archive are ignored). The result is a MovePlan whose source is the
+// archive; written[i] is MOVED when plan.moves[i] was created, and
+// FOUND_IN_PLACE when its target already held the same content (an earlier
+// import that stopped before recording it). Both count as imported. With
+// `dryRun` nothing is written and the plan only describes the import.
+inline MovePlan importArchive(const std::filesystem::path& path, const RuleMatcher& rules, bool dryRun,
+                              std::vector<char>& written, MoveReport& report) {
+    MovePlan plan;
+    plan.source = path;
+    written.clear();
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        report.errors.push_back("Could not open " + path.string() + ": " + std::strerror(errno));
+        return plan;
+    }
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    TarReader reader(fd);
+    TarEntry entry;
+    std::string data, error;
+    std::unordered_map<std::string, uint32_t> dirIndex;
+    std::vector<int> dirFds;
+    while (reader.next(entry, error)) {
+        if (!entry.regular()) continue;
+        std::string name = std::filesystem::path(entry.path).filename().string();
+        if (name.empty() || name[0] == '.') continue;  // e.g. macOS "._" resource forks
+        if (entry.size > archive::MAX_MEMBER_BYTES) {
+            report.errors.push_back("Skipping oversized member " + entry.path);
+            continue;
+        }
+        if (!reader.read(data, error)) break;
+
+        GameHeader header;
+        bool loaded = false;
+        auto loadHeader = [&]() -> const GameHeader* {
+            if (!loaded) {
+                parseGameHeader(data, true, header);
+                loaded = true;
+            }
+            return &header;
+        };
+        auto match = rules.match(name, loadHeader);
+        std::string layout;
+        GameSummary game;
+        if (match) {
+            game = summarizeGame(*match->rule, name, loadHeader(),
+                                 [&]() { return kifConclusion(conclusionTail(data)); }, match->date);
+        }
+        if (!match || !RuleMatcher::layoutPath(*match->rule, match->date, game.date, name, layout)) {
+            plan.unmatched.push_back(entry.path);
+            continue;
+        }
+        std::filesystem::path dir = std::filesystem::path(match->rule->outputPath) / layout;
+        auto [it, inserted] = dirIndex.emplace(dir.string(), static_cast<uint32_t>(plan.dirs.size()));
+        if (inserted) {
+            plan.dirs.push_back(dir);
+            dirFds.push_back(-1);
+        }
+        plan.moves.push_back({name, it->second, match->rule, std::move(game)});
+        written.push_back(0);
+        if (dryRun) continue;
+
+        int& dstFd = dirFds[it->second];
+        if (dstFd < 0) {
+            std::error_code ec;
+            std::filesystem::create_directories(dir, ec);
+            dstFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (dstFd < 0) {
+                report.errors.push_back("Could not create " + dir.string() + ": " +
+                                        (ec ? ec.message() : std::strerror(errno)));
+                continue;
+            }
+        }
+        std::string writeError;
+        bool existed = false;
+        if (archive::writeMember(dstFd, name, entry, data, dir / name, existed, writeError)) {
+            written.back() = existed ? FOUND_IN_PLACE : MOVED;
+            ++report.moved;
+        } else {
+            report.errors.push_back(writeError);
+        }
+    }
+    if (!error.empty()) report.errors.push_back(path.string() + ": " + error);
+    ::close(fd);
+
+    // One syncfs per target filesystem covers every file written above
+    std::unordered_set<dev_t> synced;
+    for (size_t d = 0; d < dirFds.size(); ++d) {
+        struct stat st;
+        if (dirFds[d] < 0) continue;
+        if (::fstat(dirFds[d], &st) == 0 && synced.insert(st.st_dev).second && ::syncfs(dirFds[d]) != 0) {
+            report.errors.push_back("Could not sync " + plan.dirs[d].string() + ": " + std::strerror(errno));
+        }
+        ::close(dirFds[d]);
+    }
+    return plan;
+}
@@ -0,0 +1,96 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "walker.hpp"
+#include "kif.hpp"
+
+// Parse every .kif below a folder with kif::parse over mmap, against the
+// usual approach of reading the file into a string, decoding it to UTF-8
+// and splitting it into line strings. Single-threaded, so the numbers are
+// per core; run it twice to measure with a warm page cache.
+
+struct Totals {
+    size_t files = 0, bytes = 0, moves = 0, comments = 0, errors = 0, unparsed = 0;
+};
+
+Totals parseAll(const std::vector<std::filesystem::path>& files) {
+    Totals t;
+    kif::Record record;
+    std::string error;
+    for (const auto& path : files) {
+        kif::KifFile file;
+        if (!file.open(path, error)) {
+            ++t.errors;
+            continue;
+        }
+        ++t.files;
+        t.bytes += file.data().size();
+        if (!kif::parse(file.data(), record, error)) ++t.errors;
+        t.moves += record.moves.size();
+        for (size_t i = 0; i < record.moves.size(); ++i) {
+            t.comments += !record.moves[i].comments.empty();
+            // Only the final move may be 投了, 詰み, 切れ負け, ...
+            t.unparsed += record.moves[i].special() && i + 1 < record.moves.size();
+        }
+    }
+    return t;
+}
+
+Totals copyAll(const std::vector<std::filesystem::path>& files) {
+    Totals t;
+    for (const auto& path : files) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            ++t.errors;
+            continue;
+        }
+        std::stringstream buf;
+        buf << in.rdbuf();
+        std::string raw = buf.str();
+        ++t.files;
+        t.bytes += raw.size();
+        std::istringstream text(sjis::decodeText(raw));
+        std::vector<std::string> lines;
+        std::string line;
+        while (std::getline(text, line)) {
+            if (!line.empty() && line[0] >= ' ' && line.find_first_not_of(' ') < line.size() &&
+                line[line.find_first_not_of(' ')] >= '0' && line[line.find_first_not_of(' ')] <= '9') {
+                ++t.moves;
+            }
+            lines.push_back(std::move(line));
+        }
+    }
+    return t;
+}
+
+template <typename Fn>
+double seconds(Fn fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    std::string root = argc > 1 ? argv[1] : "Evaluation";
+    std::vector<std::filesystem::path> files;
+    std::vector<std::string> unreadable;
+    for (auto& path : listFiles(root, {1, -1}, unreadable)) {
+        if (path.extension() == ".kif") files.push_back(path);
+    }
+    for (const auto& e : unreadable) std::cerr << "Error: " << e << "\n";
+
+    Totals parsed, copied;
+    double tParse = seconds([&]() { parsed = parseAll(files); });
+    double tCopy = seconds([&]() { copied = copyAll(files); });
+
+    double mb = parsed.bytes / 1e6;
+    std::cout << parsed.files << " files, " << mb << " MB, " << parsed.moves << " moves, " << parsed.comments
+              << " commented moves\n"
+              << "kif::parse (mmap):       " << tParse << " s, " << mb / tParse << " MB/s, " << parsed.errors
+              << " errors, " << parsed.unparsed << " unparsed moves\n"
+              << "read + decode + lines:   " << tCopy << " s, " << mb / tCopy << " MB/s (" << tCopy / tParse << "x)\n";
+    return parsed.errors == 0 && parsed.unparsed == 0 ? 0 : 1;
+}
@@ -0,0 +1,104 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include "walker.hpp"
+#include "kif.hpp"
+#include "position.hpp"
+
+// Perft from the starting position, checked against the published counts,
+// and the speed of replaying every .kif below a folder: shogi::replay
+// (checking that each KIF move is legal and keeping the key of every
+// position), then plain doMove/undoMove over the same games. Files are
+// parsed once up front.
+
+template <typename Fn>
+double seconds(Fn fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    std::string root = argc > 1 ? argv[1] : "Evaluation";
+    int depth = argc > 2 ? std::stoi(argv[2]) : 5;
+    int rounds = argc > 3 ? std::stoi(argv[3]) : 20;
+    static const uint64_t expected[] = {1, 30, 900, 25470, 719731, 19861490, 547581517};
+    bool ok = true;
+
+    shogi::Position pos;
+    for (int d = 1; d <= depth; ++d) {
+        uint64_t nodes = 0;
+        double t = seconds([&]() { nodes = shogi::perft(pos, d); });
+        bool known = d < static_cast<int>(std::size(expected));
+        bool match = !known || nodes == expected[d];
+        ok = ok && match;
+        std::cout << "perft " << d << ": " << nodes << (match ? "" : " (expected " + std::to_string(expected[d]) + ")")
+                  << ", " << t << " s, " << nodes / t / 1e6 << " M leaves/s\n";
+    }
+
+    std::vector<std::unique_ptr<kif::KifFile>> files;
+    std::vector<kif::Record> records;
+    std::vector<std::filesystem::path> paths;
+    std::string error;
+    std::vector<std::string> unreadable;
+    for (auto& path : listFiles(root, {1, -1}, unreadable)) {
+        if (path.extension() != ".kif") continue;
+        auto file = std::make_unique<kif::KifFile>();
+        kif::Record record;
+        if (!file->open(path, error) || !kif::parse(file->data(), record, error)) {
+            std::cerr << "Error: " << error << std::endl;
+            continue;
+        }
+        files.push_back(std::move(file));
+        records.push_back(std::move(record));
+        paths.push_back(path);
+    }
+    for (const auto& e : unreadable) std::cerr << "Error: " << e << "\n";
+
+    size_t moves = 0, invalid = 0;
+    uint64_t sink = 0;
+    std::vector<shogi::Move> played;
+    std::vector<uint64_t> keys;
+    double t = seconds([&]() {
+        for (int r = 0; r < rounds; ++r) {
+            for (size_t i = 0; i < records.size(); ++i) {
+                if (!shogi::replay(records[i], pos, played, keys, error)) {
+                    if (r == 0) std::cerr << "Error: " << paths[i].string() << ": " << error << std::endl;
+                    ++invalid;
+                    continue;
+                }
+                moves += played.size();
+                sink += keys.back();
+            }
+        }
+    });
+    // The same games from ready starting positions and without checks: play
+    // every move, then take them all back
+    std::vector<std::vector<shogi::Move>> lines(records.size());
+    std::vector<shogi::Position> starts(records.size());
+    for (size_t i = 0; i < records.size(); ++i) {
+        shogi::replay(records[i], pos, lines[i], keys, error);
+        starts[i].set(records[i], error);
+    }
+    size_t applied = 0;
+    double tMoves = seconds([&]() {
+        for (int r = 0; r < rounds; ++r) {
+            for (size_t i = 0; i < records.size(); ++i) {
+                pos = starts[i];
+                for (shogi::Move m : lines[i]) pos.doMove(m);
+                sink += pos.key();
+                for (size_t k = lines[i].size(); k-- > 0;) pos.undoMove(lines[i][k]);
+                applied += lines[i].size();
+            }
+        }
+    });
+
+    std::cout << records.size() << " games x " << rounds << " rounds, " << invalid / rounds << " invalid (" << sink
+              << ")\n"
+              << "replay: " << moves << " moves, " << t << " s, " << moves / t / 1e6 << " M moves/s\n"
+              << "doMove + undoMove: " << applied << " moves, " << tMoves << " s, " << applied / tMoves / 1e6
+              << " M moves/s\n";
+    return ok && invalid == 0 ? 0 : 1;
+}
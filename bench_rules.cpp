@@ -0,0 +1,82 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <regex>
+#include <chrono>
+#include <optional>
+#include "json.hpp"
+#include "rules.hpp"
+
+using json = nlohmann::json;
+
+// Microbenchmark of organize_kif routing: the previous per-file code
+// (a fresh std::regex per rule, then a second compile of the matched
+// pattern) against RuleMatcher, on synthetic inbox file names.
+
+std::optional<json> findSettingUncached(const std::string& filename, const json& settings) {
+    for (const auto& entry : settings) {
+        std::regex pattern(entry["pattern"].get<std::string>());
+        if (std::regex_match(filename, pattern)) {
+            return entry;
+        }
+    }
+    return std::nullopt;
+}
+
+std::string routeUncached(const std::string& filename, const json& settings) {
+    auto matched = findSettingUncached(filename, settings);
+    if (!matched) return {};
+    std::smatch match;
+    std::string pattern = (*matched)["pattern"];
+    if (std::regex_match(filename, match, std::regex(pattern))) return match[1];
+    return {};
+}
+
+std::vector<std::string> makeNames(size_t count) {
+    std::vector<std::string> names;
+    for (size_t i = 0; i < count; ++i) {
+        std::string n = std::to_string(100000 + i);
+        switch (i % 4) {
+            case 0: names.push_back("Love_Kapibara-player" + n + "-20250628_1" + n.substr(1) + ".kif"); break;
+            case 1: names.push_back(n + "_0712_[Squika]1722_xo_[komasan88]1870.kif"); break;
+            case 2: names.push_back("14" + n + "-Al-iwq_vs_Love_Kapibarasan-2025-08-09.pgn"); break;
+            default: names.push_back("notes-" + n + ".txt"); break;
+        }
+    }
+    return names;
+}
+
+template <typename Fn>
+double seconds(Fn fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    std::string settingFile = argc > 1 ? argv[1] : "setting.json";
+    size_t count = argc > 2 ? std::stoul(argv[2]) : 50000;
+    std::ifstream file(settingFile);
+    if (!file.is_open()) {
+        std::cerr << "Could not open " << settingFile << "\n";
+        return 1;
+    }
+    json settings;
+    file >> settings;
+    std::vector<std::string> names = makeNames(count);
+
+    size_t routedOld = 0, routedNew = 0;
+    double tOld = seconds([&]() {
+        for (const auto& n : names) routedOld += !routeUncached(n, settings).empty();
+    });
+    double tNew = seconds([&]() {
+        RuleMatcher rules(settings);
+        for (const auto& n : names) routedNew += rules.match(n).has_value();
+    });
+
+    std::cout << count << " names, " << settings.size() << " rules\n"
+              << "per-file std::regex: " << tOld << " s, " << routedOld << " routed\n"
+              << "RuleMatcher:         " << tNew << " s, " << routedNew << " routed (" << tOld / tNew << "x)\n";
+    return routedOld == routedNew ? 0 : 1;
+}
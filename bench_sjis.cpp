@@ -0,0 +1,97 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <iconv.h>
+#include "walker.hpp"
+#include "kif.hpp"
+#include "sjis.hpp"
+
+// CP932 → UTF-8 throughput on the .kif files below a folder: the previous
+// one-character-at-a-time decoder, sjis::toUtf8 and glibc's iconv(3).
+// The corpus is held in memory and decoded `rounds` times, so the numbers
+// are single-core decode speed without I/O. The output of toUtf8 is also
+// checked against the reference on the corpus and on random bytes.
+
+std::string toUtf8Reference(std::string_view in) {
+    std::string out;
+    out.reserve(in.size() + in.size() / 2);
+    size_t i = 0;
+    while (i < in.size()) sjis::appendUtf8(out, sjis::decodeChar(in, i));
+    return out;
+}
+
+std::string toUtf8Iconv(iconv_t cd, std::string_view in) {
+    std::string out(in.size() * 3, '\0');
+    char* src = const_cast<char*>(in.data());
+    size_t srcLeft = in.size();
+    char* dst = &out[0];
+    size_t dstLeft = out.size();
+    while (srcLeft > 0 && ::iconv(cd, &src, &srcLeft, &dst, &dstLeft) == static_cast<size_t>(-1)) {
+        ++src;  // skip an invalid byte, as the other decoders substitute it
+        --srcLeft;
+    }
+    out.resize(out.size() - dstLeft);
+    return out;
+}
+
+template <typename Fn>
+double seconds(Fn fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    std::string root = argc > 1 ? argv[1] : "Evaluation";
+    int rounds = argc > 2 ? std::stoi(argv[2]) : 20;
+    std::vector<std::string> corpus;
+    size_t bytes = 0, cp932 = 0;
+    std::string error;
+    std::vector<std::string> unreadable;
+    for (auto& path : listFiles(root, {1, -1}, unreadable)) {
+        if (path.extension() != ".kif") continue;
+        kif::KifFile file;
+        if (!file.open(path, error)) continue;
+        corpus.emplace_back(file.data());
+        bytes += corpus.back().size();
+        cp932 += sjis::detect(corpus.back()) == sjis::Encoding::Cp932;
+    }
+    for (const auto& e : unreadable) std::cerr << "Error: " << e << "\n";
+
+    size_t mismatches = 0;
+    for (const auto& text : corpus) mismatches += sjis::toUtf8(text) != toUtf8Reference(text);
+    std::mt19937 rng(1);
+    for (int k = 0; k < 2000; ++k) {
+        std::string noise(rng() % 300, '\0');
+        for (char& c : noise) c = static_cast<char>(rng() % 4 ? rng() % 256 : rng() % 128);
+        mismatches += sjis::toUtf8(noise) != toUtf8Reference(noise);
+    }
+
+    size_t sink = 0;
+    double tRef = seconds([&]() {
+        for (int r = 0; r < rounds; ++r) for (const auto& text : corpus) sink += toUtf8Reference(text).size();
+    });
+    double tNew = seconds([&]() {
+        for (int r = 0; r < rounds; ++r) for (const auto& text : corpus) sink += sjis::toUtf8(text).size();
+    });
+    iconv_t cd = ::iconv_open("UTF-8", "CP932");
+    double tIconv = seconds([&]() {
+        for (int r = 0; r < rounds; ++r) {
+            for (const auto& text : corpus) {
+                ::iconv(cd, nullptr, nullptr, nullptr, nullptr);
+                sink += toUtf8Iconv(cd, text).size();
+            }
+        }
+    });
+    ::iconv_close(cd);
+
+    double mb = static_cast<double>(bytes) * rounds / 1e6;
+    std::cout << corpus.size() << " files (" << cp932 << " CP932), " << bytes / 1e6 << " MB x " << rounds
+              << " rounds, " << mismatches << " mismatches (" << sink << ")\n"
+              << "per character:  " << mb / tRef << " MB/s\n"
+              << "sjis::toUtf8:   " << mb / tNew << " MB/s (" << tRef / tNew << "x)\n"
+              << "iconv(3):       " << mb / tIconv << " MB/s\n";
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,84 @@
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include "walker.hpp"
+
+namespace fs = std::filesystem;
+
+// Benchmark Walker against fs::recursive_directory_iterator on a generated
+// date-sharded tree (<root>/YYYYMMDD/<n>.kif, 1000 files per directory).
+
+const size_t FILES_PER_DIR = 1000;
+
+// Generate the tree unless a previous run already left one of the same size
+void generateTree(const fs::path& root, size_t files) {
+    fs::path marker = root / (".generated_" + std::to_string(files));
+    if (fs::exists(marker)) return;
+    fs::remove_all(root);
+    std::cout << "Generating " << files << " files in " << root << "...\n";
+
+    size_t dirs = (files + FILES_PER_DIR - 1) / FILES_PER_DIR;
+    for (size_t d = 0; d < dirs; ++d) {
+        char shard[32];
+        std::snprintf(shard, sizeof(shard), "%04zu%02zu%02zu", 2000 + d / 372, 1 + d / 31 % 12, 1 + d % 31);
+        fs::path dir = root / shard;
+        fs::create_directories(dir);
+        for (size_t f = d * FILES_PER_DIR; f < std::min(files, (d + 1) * FILES_PER_DIR); ++f) {
+            std::string name = (dir / (std::to_string(f) + ".kif")).string();
+            int fd = ::open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd >= 0) ::close(fd);
+        }
+    }
+    std::ofstream(marker.string()).put('\n');
+}
+
+template <typename Fn>
+double timeIt(Fn fn, size_t& count) {
+    auto start = std::chrono::steady_clock::now();
+    count = fn();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: bench_walker <tree_dir> [files=1000000]\n";
+        return 1;
+    }
+    fs::path root = argv[1];
+    size_t files = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1000000;
+    generateTree(root, files);
+
+    size_t count = 0;
+    double base = timeIt([&]() {
+        size_t n = 0;
+        for (const auto& entry : fs::recursive_directory_iterator(root)) {
+            if (fs::is_regular_file(entry.path())) ++n;
+        }
+        return n;
+    }, count);
+    std::cout << "recursive_directory_iterator: " << count << " files in " << base << " s\n";
+
+    std::vector<unsigned> threadCounts;
+    for (unsigned t = 1; t < Walker::workers(); t *= 2) threadCounts.push_back(t);
+    threadCounts.push_back(Walker::workers());
+    for (unsigned threads : threadCounts) {
+        double t = timeIt([&]() {
+            std::atomic<size_t> n{0};
+            Walker::walk(root, {threads, -1}, [&](unsigned, const WalkEntry&) {
+                n.fetch_add(1, std::memory_order_relaxed);
+            });
+            return n.load();
+        }, count);
+        std::cout << "Walker, " << threads << " thread(s): " << count << " files in " << t
+                  << " s (" << base / t << "x)\n";
+    }
+    return 0;
+}
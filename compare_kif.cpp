@@ -1,52 +1,752 @@
 #include <iostream>
 #include <filesystem>
 #include <unordered_set>
+#include <unordered_map>
 #include <string>
-#include <cstdlib>
+#include <string_view>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "hash128.hpp"
+#include "parallel.hpp"
+#include "trash.hpp"
+#include "reflink.hpp"
+#include "walker.hpp"
+#include "kif_index.hpp"
+#include "sjis.hpp"
 
 namespace fs = std::filesystem;
 
+enum class Mode { Name, Content, Game };
+
+// Which file of a duplicate group survives in N-way mode
+enum class KeepPolicy { RootOrder, Oldest, Newest, Largest, MostAnnotated };
+
+struct Options {
+    Mode mode = Mode::Name;
+    bool verify = false;
+    bool useIndex = false;
+    bool link = false;
+    bool nway = false;
+    KeepPolicy keep = KeepPolicy::RootOrder;
+    unsigned threads = 0;
+    fs::path folderA;
+    fs::path folderB;
+    std::vector<fs::path> roots;  // all folders, in preference order
+};
+
+// A file to remove and, in content mode, the file it duplicates
+struct Duplicate {
+    fs::path path;
+    fs::path original;
+    fs::path promote;  // richer copy moved into `path` once it is trashed
+};
+
+// Move-sequence fingerprint of a game record
+struct GameInfo {
+    fs::path path;
+    size_t root = 0;
+    bool ok = false;
+    size_t moves = 0;
+    size_t analysisLines = 0;
+    Hash128 fingerprint;
+};
+
+// Report the directories a walk could not read
+void printUnreadable(const std::vector<std::string>& errors) {
+    for (const auto& error : errors) std::cerr << error << "\n";
+}
+
+// Every regular file below a folder
+std::vector<fs::path> listAll(const fs::path& root, unsigned threads) {
+    std::vector<std::string> errors;
+    std::vector<fs::path> files = listFiles(root, {threads, -1}, errors);
+    printUnreadable(errors);
+    return files;
+}
+
 // Recursively collect all file names in a folder
-void collectFiles(const fs::path& root, std::unordered_set<std::string>& files) {
-    for (const auto& entry : fs::recursive_directory_iterator(root)) {
-        if (fs::is_regular_file(entry.path())) {
-            files.insert(entry.path().filename().string());
-        }
+void collectFiles(const fs::path& root, unsigned threads, std::unordered_set<std::string>& files) {
+    std::vector<std::vector<std::string>> perWorker(Walker::workers(threads));
+    printUnreadable(Walker::walk(root, {threads, -1}, [&](unsigned worker, const WalkEntry& e) {
+        perWorker[worker].emplace_back(e.name);
+    }));
+    for (auto& names : perWorker) {
+        for (auto& name : names) files.insert(std::move(name));
     }
 }
 
-// Move file to trash (Linux)
-void moveToTrash(const fs::path& filePath) {
-    std::string cmd = "gio trash '" + filePath.string() + "'";
-    std::system(cmd.c_str());
+// A file taking part in content deduplication
+struct Candidate {
+    fs::path path;
+    uint64_t size = 0;
+    size_t root = 0;
+    bool ok = true;
+    Hash128 edge;  // set by stage 2
+    Hash128 full;  // set by stage 3
+};
+
+// Per-stage counters of the content pipeline
+struct PipelineStats {
+    size_t files = 0;
+    size_t afterSize = 0;
+    size_t afterPartial = 0;
+    size_t afterFull = 0;
+    uint64_t bytesTotal = 0;
+    uint64_t bytesEdge = 0;  // read by the partial stage
+    uint64_t bytesFull = 0;  // read by the full stage, which rereads the edges
+};
+
+// Recursively collect all regular files in a folder with their sizes
+void collectCandidates(const fs::path& root, size_t rootIndex, unsigned threads, std::vector<Candidate>& out) {
+    std::vector<std::vector<Candidate>> perWorker(Walker::workers(threads));
+    printUnreadable(Walker::walk(root, {threads, -1}, [&](unsigned worker, const WalkEntry& e) {
+        struct stat st;
+        Candidate c;
+        c.path = e.path();
+        c.ok = ::fstatat(e.dirfd, e.name, &st, 0) == 0;
+        c.size = c.ok ? static_cast<uint64_t>(st.st_size) : 0;
+        c.root = rootIndex;
+        perWorker[worker].push_back(std::move(c));
+    }));
+    for (auto& part : perWorker) {
+        std::move(part.begin(), part.end(), std::back_inserter(out));
+    }
 }
 
-int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        std::cerr << "Usage: compare_kif <folder_a> <folder_b>\n";
-        return 1;
+struct SizedHash {
+    uint64_t size;
+    Hash128 hash;
+    bool operator==(const SizedHash& other) const { return size == other.size && hash == other.hash; }
+};
+
+struct SizedHashHasher {
+    size_t operator()(const SizedHash& k) const {
+        return Hash128Hasher{}(k.hash) ^ static_cast<size_t>(k.size * 0x9e3779b97f4a7c15ULL);
     }
-    fs::path folderA = argv[1];
-    fs::path folderB = argv[2];
-    if (!fs::is_directory(folderA) || !fs::is_directory(folderB)) {
-        std::cerr << "Both arguments must be folders.\n";
-        return 1;
+};
+
+SizedHash sizedFull(const Candidate& c) { return SizedHash{c.size, c.full}; }
+
+// Keep only the candidates whose key is shared with another file. In
+// two-folder mode the key must occur in folder A and in another folder; in
+// N-way mode (`anyRoot`) two files anywhere are enough.
+template <typename Key, typename KeyHasher, typename KeyFn>
+std::vector<size_t> keepSharedKeys(const std::vector<Candidate>& cands, const std::vector<size_t>& alive,
+                                   bool anyRoot, KeyFn key) {
+    struct Seen {
+        size_t count = 0;
+        bool first = false;
+        bool other = false;
+    };
+    std::unordered_map<Key, Seen, KeyHasher> seen;
+    for (size_t i : alive) {
+        if (!cands[i].ok) continue;
+        Seen& s = seen[key(cands[i])];
+        ++s.count;
+        (cands[i].root == 0 ? s.first : s.other) = true;
+    }
+    std::vector<size_t> kept;
+    for (size_t i : alive) {
+        if (!cands[i].ok) continue;
+        const Seen& s = seen[key(cands[i])];
+        if (anyRoot ? s.count >= 2 : s.first && s.other) kept.push_back(i);
     }
+    return kept;
+}
 
-    std::unordered_set<std::string> filesA;
-    collectFiles(folderA, filesA);
+// Byte-by-byte comparison used to confirm a hash match
+bool sameContent(const fs::path& a, const fs::path& b) {
+    std::error_code ec;
+    if (fs::file_size(a, ec) != fs::file_size(b, ec) || ec) return false;
+    int fa = ::open(a.c_str(), O_RDONLY | O_CLOEXEC);
+    int fb = ::open(b.c_str(), O_RDONLY | O_CLOEXEC);
+    bool same = fa >= 0 && fb >= 0;
+    char bufA[1 << 16], bufB[1 << 16];
+    while (same) {
+        ssize_t na = ::read(fa, bufA, sizeof(bufA));
+        ssize_t nb = ::read(fb, bufB, sizeof(bufB));
+        if (na != nb || na < 0) same = false;
+        else if (na == 0) break;
+        else same = std::memcmp(bufA, bufB, static_cast<size_t>(na)) == 0;
+    }
+    if (fa >= 0) ::close(fa);
+    if (fb >= 0) ::close(fb);
+    return same;
+}
 
+// Move all duplicates to the trash in one pass (Linux, freedesktop Trash)
+int moveToTrash(const std::vector<Duplicate>& duplicates) {
+    Trash trash;
     int removed = 0;
-    for (const auto& entry : fs::recursive_directory_iterator(folderB)) {
-        if (fs::is_regular_file(entry.path())) {
-            std::string fname = entry.path().filename().string();
-            if (filesA.count(fname)) {
-                std::cout << "Removing: " << entry.path() << "\n";
-                moveToTrash(entry.path());
-                ++removed;
+    for (const Duplicate& dup : duplicates) {
+        std::cout << "Removing: " << dup.path;
+        if (!dup.original.empty()) std::cout << " (same as " << dup.original << ")";
+        std::cout << "\n";
+        std::string error;
+        if (!trash.move(dup.path, error)) {
+            std::cerr << "Could not trash " << dup.path << ": " << error << "\n";
+            continue;
+        }
+        ++removed;
+        if (!dup.promote.empty()) {
+            std::cout << "Replacing with richer copy: " << dup.promote << "\n";
+            std::error_code ec;
+            fs::rename(dup.promote, dup.path, ec);
+            if (ec) std::cerr << "Could not move " << dup.promote << ": " << ec.message() << "\n";
+        }
+    }
+    return removed;
+}
+
+// Replace byte-identical duplicates by reflinks (or hardlinks) to their original
+int linkDuplicates(const std::vector<Duplicate>& duplicates) {
+    LinkReplacer linker;
+    int linked = 0;
+    for (const Duplicate& dup : duplicates) {
+        std::string error;
+        switch (linker.replace(dup.original, dup.path, error)) {
+            case LinkReplacer::Result::Reflinked:
+                std::cout << "Reflinked: " << dup.path << " -> " << dup.original << "\n";
+                ++linked;
+                break;
+            case LinkReplacer::Result::Hardlinked:
+                std::cout << "Hardlinked: " << dup.path << " -> " << dup.original << "\n";
+                ++linked;
+                break;
+            case LinkReplacer::Result::Failed:
+                std::cerr << "Could not link " << dup.path << ": " << error << "\n";
+                break;
+        }
+    }
+    return linked;
+}
+
+// Find files in folder B whose name also exists in folder A
+void findByName(const Options& opt, std::vector<Duplicate>& duplicates) {
+    std::unordered_set<std::string> filesA;
+    collectFiles(opt.folderA, opt.threads, filesA);
+
+    for (auto& path : listAll(opt.folderB, opt.threads)) {
+        if (filesA.count(path.filename().string())) {
+            duplicates.push_back({std::move(path), {}, {}});
+        }
+    }
+}
+
+// Same as findByName, probing the persistent index of folder A
+void findByNameIndexed(const Options& opt, const KifIndex& index, std::vector<Duplicate>& duplicates) {
+    for (auto& path : listAll(opt.folderB, opt.threads)) {
+        if (const auto* rec = index.findName(path.filename().string())) {
+            duplicates.push_back({std::move(path), index.filePath(*rec), {}});
+        }
+    }
+}
+
+// Stage 2: hash the head and tail of every surviving candidate
+void hashEdgeStage(std::vector<Candidate>& cands, const std::vector<size_t>& alive, unsigned threads,
+                   PipelineStats& stats) {
+    std::atomic<uint64_t> bytesRead{0};
+    parallelFor(alive.size(), threads, [&](size_t k) {
+        Candidate& c = cands[alive[k]];
+        c.ok = hashFileEdges(c.path, c.size, c.edge);
+        c.full = c.edge;
+        bytesRead += std::min(c.size, 2 * EDGE_BYTES);
+    });
+    stats.bytesEdge += bytesRead;
+}
+
+// Stage 3: hash the full content of candidates larger than their edges
+void hashFullStage(std::vector<Candidate>& cands, const std::vector<size_t>& alive, unsigned threads,
+                   PipelineStats& stats) {
+    std::vector<size_t> large;
+    for (size_t i : alive) {
+        if (cands[i].size > 2 * EDGE_BYTES) large.push_back(i);
+    }
+    std::atomic<uint64_t> bytesRead{0};
+    parallelFor(large.size(), threads, [&](size_t k) {
+        Candidate& c = cands[large[k]];
+        c.ok = hashFile(c.path, c.full);
+        bytesRead += c.size;
+    });
+    stats.bytesFull += bytesRead;
+}
+
+void printStats(const std::vector<Candidate>& cands, const PipelineStats& stats) {
+    for (const Candidate& c : cands) {
+        if (!c.ok) std::cerr << "Could not read: " << c.path << "\n";
+    }
+    std::cout << "Files scanned: " << stats.files << "\n"
+              << "  size stage eliminated:    " << stats.files - stats.afterSize << "\n"
+              << "  partial stage eliminated: " << stats.afterSize - stats.afterPartial << "\n"
+              << "  full stage eliminated:    " << stats.afterPartial - stats.afterFull << "\n"
+              << "  remaining candidates:     " << stats.afterFull << "\n"
+              << "Bytes read: " << stats.bytesEdge << " by the partial stage, " << stats.bytesFull
+              << " by the full stage, of " << stats.bytesTotal << " scanned\n";
+}
+
+// Record a confirmed match of candidate `c` against `original`
+void addContentDuplicate(const Options& opt, const fs::path& original, const Candidate& c,
+                         std::vector<Duplicate>& duplicates) {
+    std::error_code ec;
+    if (fs::equivalent(original, c.path, ec)) return;
+    if (opt.verify && !sameContent(original, c.path)) {
+        std::cerr << "Hash collision, keeping: " << c.path << "\n";
+        return;
+    }
+    duplicates.push_back({c.path, original, {}});
+}
+
+// Narrow candidates down to files whose content is shared with another
+// file: by size, then by a hash of their first and last 4 KiB, and only
+// files that still collide are hashed in full. Returns the survivors.
+std::vector<size_t> narrowByContent(std::vector<Candidate>& cands, const Options& opt, PipelineStats& stats) {
+    stats.files = cands.size();
+    std::vector<size_t> alive(cands.size());
+    for (size_t i = 0; i < cands.size(); ++i) {
+        alive[i] = i;
+        stats.bytesTotal += cands[i].size;
+    }
+
+    // Stage 1: file size
+    alive = keepSharedKeys<uint64_t, std::hash<uint64_t>>(
+        cands, alive, opt.nway, [](const Candidate& c) { return c.size; });
+    stats.afterSize = alive.size();
+
+    // Stage 2: head and tail
+    hashEdgeStage(cands, alive, opt.threads, stats);
+    alive = keepSharedKeys<SizedHash, SizedHashHasher>(
+        cands, alive, opt.nway, [](const Candidate& c) { return SizedHash{c.size, c.edge}; });
+    stats.afterPartial = alive.size();
+
+    // Stage 3: full content, only for files larger than the edges
+    hashFullStage(cands, alive, opt.threads, stats);
+    alive = keepSharedKeys<SizedHash, SizedHashHasher>(cands, alive, opt.nway, sizedFull);
+    stats.afterFull = alive.size();
+    return alive;
+}
+
+// Find files in folder B whose content also exists in folder A
+void findByContent(const Options& opt, std::vector<Duplicate>& duplicates) {
+    std::vector<Candidate> cands;
+    collectCandidates(opt.folderA, 0, opt.threads, cands);
+    collectCandidates(opt.folderB, 1, opt.threads, cands);
+
+    PipelineStats stats;
+    std::vector<size_t> alive = narrowByContent(cands, opt, stats);
+
+    std::unordered_map<SizedHash, size_t, SizedHashHasher> indexA;
+    for (size_t i : alive) {
+        if (cands[i].root == 0) indexA.emplace(sizedFull(cands[i]), i);
+    }
+    for (size_t i : alive) {
+        if (cands[i].root != 0) addContentDuplicate(opt, cands[indexA.at(sizedFull(cands[i]))].path, cands[i], duplicates);
+    }
+    printStats(cands, stats);
+}
+
+// Same pipeline as findByContent, but folder A's sizes and hashes come from
+// its persistent index, so only files in folder B are read
+void findByContentIndexed(const Options& opt, const KifIndex& index, std::vector<Duplicate>& duplicates) {
+    std::vector<Candidate> cands;
+    collectCandidates(opt.folderB, 1, opt.threads, cands);
+
+    PipelineStats stats;
+    stats.files = cands.size();
+    std::vector<size_t> alive;
+    for (size_t i = 0; i < cands.size(); ++i) {
+        stats.bytesTotal += cands[i].size;
+        if (cands[i].ok && index.hasSize(cands[i].size)) alive.push_back(i);
+    }
+    stats.afterSize = alive.size();
+
+    auto keep = [&](auto found) {
+        std::vector<size_t> kept;
+        for (size_t i : alive) {
+            if (cands[i].ok && found(cands[i])) kept.push_back(i);
+        }
+        alive.swap(kept);
+    };
+    hashEdgeStage(cands, alive, opt.threads, stats);
+    keep([&](const Candidate& c) { return index.findEdge(c.size, c.edge) != nullptr; });
+    stats.afterPartial = alive.size();
+
+    hashFullStage(cands, alive, opt.threads, stats);
+    keep([&](const Candidate& c) { return index.findFull(c.size, c.full) != nullptr; });
+    stats.afterFull = alive.size();
+
+    for (size_t i : alive) {
+        const KifIndex::FileRecord* rec = index.findFull(cands[i].size, cands[i].full);
+        if (!index.stillValid(*rec)) {
+            std::cerr << "Index entry is stale, keeping: " << cands[i].path << "\n";
+            continue;
+        }
+        addContentDuplicate(opt, index.filePath(*rec), cands[i], duplicates);
+    }
+    printStats(cands, stats);
+}
+
+// KIF keywords, matched after the game is decoded to UTF-8
+const std::string_view KIF_HANDICAP = "\xe6\x89\x8b\xe5\x90\x88\xe5\x89\xb2";  // 手合割
+const std::string_view KIF_HAND = "\xe6\x8c\x81\xe9\xa7\x92";                    // 持駒
+const std::string_view KIF_VARIATION = "\xe5\xa4\x89\xe5\x8c\x96";               // 変化
+
+bool contains(std::string_view line, std::string_view word) { return line.find(word) != std::string_view::npos; }
+
+// Fingerprint the main line of a KIF: the start position (handicap, board
+// and hands) plus every move token, ignoring comments, engine analysis and
+// time columns, so a raw download and an annotated copy of the same game
+// hash alike. CP932 files are decoded to UTF-8 first, so a game also
+// matches its copy in the other encoding. Stops at the first variation.
+void fingerprintGame(std::string_view data, GameInfo& game) {
+    thread_local std::string decoded;
+    if (data.substr(0, 3) == "\xEF\xBB\xBF") {
+        data.remove_prefix(3);
+    } else if (sjis::detect(data) == sjis::Encoding::Cp932) {
+        sjis::toUtf8(data, decoded);
+        data = decoded;
+    }
+    Hasher128 start, moves;
+    size_t pos = 0;
+    while (pos < data.size()) {
+        size_t end = data.find('\n', pos);
+        if (end == std::string_view::npos) end = data.size();
+        std::string_view line = data.substr(pos, end - pos);
+        pos = end + 1;
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        if (line.empty()) continue;
+
+        if (line[0] == '*') {
+            if (line.size() > 1 && line[1] == '*') ++game.analysisLines;
+            continue;
+        }
+        if (line[0] == '#' || line[0] == '&') continue;
+        if (contains(line, KIF_VARIATION)) break;
+
+        size_t i = line.find_first_not_of(' ');
+        size_t digits = i;
+        while (digits < line.size() && line[digits] >= '0' && line[digits] <= '9') ++digits;
+        if (i != std::string_view::npos && digits > i && digits < line.size() && line[digits] == ' ') {
+            size_t from = line.find_first_not_of(' ', digits);
+            if (from == std::string_view::npos) continue;
+            size_t to = line.find(' ', from);
+            std::string_view token = line.substr(from, to == std::string_view::npos ? line.size() - from : to - from);
+            moves.update(token.data(), token.size());
+            moves.update("\n", 1);
+            ++game.moves;
+        } else if (game.moves == 0 && (line[0] == '|' || contains(line, KIF_HANDICAP) || contains(line, KIF_HAND))) {
+            start.update(line.data(), line.size());
+            start.update("\n", 1);
+        }
+    }
+    Hash128 parts[2] = {start.finish(), moves.finish()};
+    game.fingerprint = hash128(parts, sizeof(parts));
+}
+
+// Read a whole file into `out`
+bool readFile(const fs::path& path, std::string& out) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    bool ok = ::fstat(fd, &st) == 0;
+    if (ok) {
+        out.resize(static_cast<size_t>(st.st_size));
+        size_t done = 0;
+        while (done < out.size()) {
+            ssize_t n = ::read(fd, &out[done], out.size() - done);
+            if (n <= 0) break;
+            done += static_cast<size_t>(n);
+        }
+        out.resize(done);
+    }
+    ::close(fd);
+    return ok;
+}
+
+// Fingerprint every file below `roots` in parallel and group the games by
+// fingerprint; files without moves are left out
+std::unordered_map<Hash128, std::vector<size_t>, Hash128Hasher>
+fingerprintAll(const std::vector<fs::path>& roots, unsigned threads, std::vector<GameInfo>& games) {
+    for (size_t r = 0; r < roots.size(); ++r) {
+        for (auto& path : listAll(roots[r], threads)) {
+            GameInfo game;
+            game.path = std::move(path);
+            game.root = r;
+            games.push_back(std::move(game));
+        }
+    }
+
+    parallelFor(games.size(), threads, [&](size_t i) {
+        thread_local std::string buf;
+        games[i].ok = readFile(games[i].path, buf);
+        if (games[i].ok) fingerprintGame(buf, games[i]);
+    });
+
+    std::unordered_map<Hash128, std::vector<size_t>, Hash128Hasher> groups;
+    size_t parsed = 0;
+    for (size_t i = 0; i < games.size(); ++i) {
+        if (!games[i].ok) std::cerr << "Could not read: " << games[i].path << "\n";
+        if (!games[i].ok || games[i].moves == 0) continue;
+        groups[games[i].fingerprint].push_back(i);
+        ++parsed;
+    }
+    std::cout << "Games fingerprinted: " << parsed << " of " << games.size() << " files\n";
+    return groups;
+}
+
+// Find games in folder B that are also recorded in folder A, even when the
+// files differ (e.g. one of them carries engine analysis). The copy with
+// the most analysis lines is kept: if that is a file in B, the copy in A
+// is trashed and replaced by it.
+void findByGame(const Options& opt, std::vector<Duplicate>& duplicates) {
+    std::vector<GameInfo> games;
+    auto groups = fingerprintAll({opt.folderA, opt.folderB}, opt.threads, games);
+
+    for (auto& [fingerprint, members] : groups) {
+        std::sort(members.begin(), members.end(), [&](size_t x, size_t y) {
+            if (games[x].analysisLines != games[y].analysisLines) {
+                return games[x].analysisLines > games[y].analysisLines;
+            }
+            return games[x].root < games[y].root;
+        });
+        const GameInfo& keeper = games[members[0]];
+        auto richestA = std::find_if(members.begin(), members.end(), [&](size_t i) { return games[i].root == 0; });
+        if (richestA == members.end()) continue;
+
+        for (size_t i : members) {
+            if (i != members[0] && games[i].root != 0) duplicates.push_back({games[i].path, keeper.path, {}});
+        }
+        if (keeper.root != 0) {
+            duplicates.push_back({games[*richestA].path, keeper.path, keeper.path});
+        }
+    }
+}
+
+// A file of a duplicate group in N-way mode
+struct Member {
+    fs::path path;
+    size_t root = 0;
+    uint64_t size = 0;
+    int64_t mtimeNs = 0;
+    size_t analysisLines = 0;
+    bool annotationsKnown = false;
+};
+
+// Fill in whatever the keep policy needs to compare group members
+void describeMembers(std::vector<Member>& group, KeepPolicy keep) {
+    for (Member& m : group) {
+        struct stat st;
+        if (::stat(m.path.c_str(), &st) == 0) {
+            m.size = static_cast<uint64_t>(st.st_size);
+            m.mtimeNs = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+        }
+        if (keep == KeepPolicy::MostAnnotated && !m.annotationsKnown) {
+            std::string buf;
+            GameInfo game;
+            if (readFile(m.path, buf)) fingerprintGame(buf, game);
+            m.analysisLines = game.analysisLines;
+            m.annotationsKnown = true;
+        }
+    }
+}
+
+// Order group members so that the one to keep comes first; ties fall back
+// to the order of the roots on the command line, then to the path
+void rankMembers(std::vector<Member>& group, KeepPolicy keep) {
+    std::sort(group.begin(), group.end(), [keep](const Member& x, const Member& y) {
+        switch (keep) {
+            case KeepPolicy::Oldest:
+                if (x.mtimeNs != y.mtimeNs) return x.mtimeNs < y.mtimeNs;
+                break;
+            case KeepPolicy::Newest:
+                if (x.mtimeNs != y.mtimeNs) return x.mtimeNs > y.mtimeNs;
+                break;
+            case KeepPolicy::Largest:
+                if (x.size != y.size) return x.size > y.size;
+                break;
+            case KeepPolicy::MostAnnotated:
+                if (x.analysisLines != y.analysisLines) return x.analysisLines > y.analysisLines;
+                break;
+            case KeepPolicy::RootOrder:
+                break;
+        }
+        if (x.root != y.root) return x.root < y.root;
+        return x.path < y.path;
+    });
+}
+
+// Deduplicate all roots at once: one combined index of every file, then
+// each group of duplicates keeps one file chosen by the keep policy
+void findNway(const Options& opt, std::vector<Duplicate>& duplicates) {
+    std::vector<std::vector<Member>> groups;
+
+    if (opt.mode == Mode::Name) {
+        std::unordered_map<std::string, size_t> byName;
+        for (size_t r = 0; r < opt.roots.size(); ++r) {
+            for (auto& path : listAll(opt.roots[r], opt.threads)) {
+                auto [it, inserted] = byName.emplace(path.filename().string(), groups.size());
+                if (inserted) groups.emplace_back();
+                Member m;
+                m.path = std::move(path);
+                m.root = r;
+                groups[it->second].push_back(std::move(m));
             }
         }
+    } else if (opt.mode == Mode::Content) {
+        std::vector<Candidate> cands;
+        for (size_t r = 0; r < opt.roots.size(); ++r) collectCandidates(opt.roots[r], r, opt.threads, cands);
+        PipelineStats stats;
+        std::unordered_map<SizedHash, size_t, SizedHashHasher> byContent;
+        for (size_t i : narrowByContent(cands, opt, stats)) {
+            auto [it, inserted] = byContent.emplace(sizedFull(cands[i]), groups.size());
+            if (inserted) groups.emplace_back();
+            Member m;
+            m.path = cands[i].path;
+            m.root = cands[i].root;
+            groups[it->second].push_back(std::move(m));
+        }
+        printStats(cands, stats);
+    } else {
+        std::vector<GameInfo> games;
+        for (auto& [fingerprint, members] : fingerprintAll(opt.roots, opt.threads, games)) {
+            groups.emplace_back();
+            for (size_t i : members) {
+                Member m;
+                m.path = games[i].path;
+                m.root = games[i].root;
+                m.analysisLines = games[i].analysisLines;
+                m.annotationsKnown = true;
+                groups.back().push_back(std::move(m));
+            }
+        }
+    }
+
+    size_t groupCount = 0;
+    for (auto& group : groups) {
+        if (group.size() < 2) continue;
+        ++groupCount;
+        describeMembers(group, opt.keep);
+        rankMembers(group, opt.keep);
+        const Member& keeper = group[0];
+        for (size_t k = 1; k < group.size(); ++k) {
+            std::error_code ec;
+            if (fs::equivalent(keeper.path, group[k].path, ec)) continue;
+            if (opt.mode == Mode::Content && opt.verify && !sameContent(keeper.path, group[k].path)) {
+                std::cerr << "Hash collision, keeping: " << group[k].path << "\n";
+                continue;
+            }
+            duplicates.push_back({group[k].path, keeper.path, {}});
+        }
+    }
+    std::cout << "Duplicate groups: " << groupCount << "\n";
+}
+
+bool parseKeepPolicy(const std::string& name, KeepPolicy& keep) {
+    if (name == "root-order") keep = KeepPolicy::RootOrder;
+    else if (name == "oldest") keep = KeepPolicy::Oldest;
+    else if (name == "newest") keep = KeepPolicy::Newest;
+    else if (name == "largest") keep = KeepPolicy::Largest;
+    else if (name == "most-annotated") keep = KeepPolicy::MostAnnotated;
+    else return false;
+    return true;
+}
+
+bool parseArgs(int argc, char* argv[], Options& opt) {
+    std::vector<std::string> folders;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--by-content") {
+            opt.mode = Mode::Content;
+        } else if (arg == "--by-game") {
+            opt.mode = Mode::Game;
+        } else if (arg == "--verify") {
+            opt.verify = true;
+        } else if (arg == "--link") {
+            opt.link = true;
+        } else if (arg == "--index") {
+            opt.useIndex = true;
+        } else if (arg == "--nway") {
+            opt.nway = true;
+        } else if (arg == "--keep" && i + 1 < argc) {
+            if (!parseKeepPolicy(argv[++i], opt.keep)) return false;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            if (!parseCount(argv[++i], opt.threads)) return false;
+        } else if (arg.rfind("--", 0) == 0) {
+            return false;
+        } else {
+            folders.push_back(arg);
+        }
+    }
+    if (opt.nway ? folders.size() < 2 || opt.useIndex : folders.size() != 2) return false;
+    if (opt.useIndex && opt.mode == Mode::Game) return false;
+    if (opt.link) {
+        // Links are only safe for byte-identical files
+        if (opt.mode == Mode::Game) return false;
+        opt.mode = Mode::Content;
+        opt.verify = true;
+    }
+    opt.roots.assign(folders.begin(), folders.end());
+    opt.folderA = folders[0];
+    opt.folderB = folders[1];
+    if (opt.threads == 0) opt.threads = std::max(1u, std::thread::hardware_concurrency());
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    if (!parseArgs(argc, argv, opt)) {
+        std::cerr << "Usage: compare_kif [--by-content [--verify] | --by-game | --link] [--index] [--threads N] <folder_a> <folder_b>\n"
+                  << "       compare_kif --nway [--keep root-order|oldest|newest|largest|most-annotated]\n"
+                  << "                   [--by-content [--verify] | --by-game | --link] [--threads N] <folder>...\n";
+        return 1;
+    }
+    for (const auto& root : opt.roots) {
+        if (!fs::is_directory(root)) {
+            std::cerr << "All arguments must be folders.\n";
+            return 1;
+        }
+    }
+
+    std::vector<Duplicate> duplicates;
+    if (opt.nway) {
+        findNway(opt, duplicates);
+    } else if (opt.useIndex) {
+        KifIndex index;
+        std::string error;
+        if (!index.open(opt.folderA, opt.threads, error)) {
+            std::cerr << "Index error: " << error << "\n";
+            return 1;
+        }
+        const auto& st = index.stats();
+        std::cout << "Index " << KifIndex::pathFor(opt.folderA) << ": " << st.files << " files, "
+                  << st.dirsRescanned << "/" << st.dirs << " directories rescanned, "
+                  << st.filesHashed << " files hashed\n";
+        if (opt.mode == Mode::Content) {
+            findByContentIndexed(opt, index, duplicates);
+        } else {
+            findByNameIndexed(opt, index, duplicates);
+        }
+    } else if (opt.mode == Mode::Content) {
+        findByContent(opt, duplicates);
+    } else if (opt.mode == Mode::Game) {
+        findByGame(opt, duplicates);
+    } else {
+        findByName(opt, duplicates);
+    }
+    std::sort(duplicates.begin(), duplicates.end(),
+              [](const Duplicate& x, const Duplicate& y) { return x.path < y.path; });
+    if (opt.link) {
+        int linked = linkDuplicates(duplicates);
+        std::cout << "Total files linked: " << linked << "\n";
+        return 0;
     }
+    int removed = moveToTrash(duplicates);
     std::cout << "Total files removed: " << removed << "\n";
     return 0;
 }
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "sjis.hpp"
+
+// Header fields of a KIF or PGN game, read without touching the moves.
+// The file is read in small chunks until the first line that starts with
+// an ASCII digit (a KIF move line such as "   1 ７六歩(77)" or PGN
+// movetext "1. e4"), so the cost depends on the header, not on the game.
+// KIF "key：value" lines and PGN [Key "value"] tags both become fields;
+// the bytes are decoded from CP932 unless they are UTF-8 already.
+
+struct GameHeader {
+    std::vector<std::pair<std::string, std::string>> fields;  // UTF-8, in file order
+
+    const std::string* find(std::string_view key) const {
+        for (const auto& [k, v] : fields) {
+            if (k == key) return &v;
+        }
+        return nullptr;
+    }
+};
+
+namespace game_header {
+
+// Read at most this much; real headers are a few hundred bytes
+constexpr size_t MAX_HEADER_BYTES = 64 * 1024;
+constexpr size_t CHUNK_BYTES = 1024;
+
+inline std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r')) s.remove_suffix(1);
+    return s;
+}
+
+// Offset just past the header: the start of the first line whose first
+// non-blank byte is a digit, or npos if no such line is complete yet
+inline size_t headerEnd(std::string_view data) {
+    size_t line = 0;
+    while (line < data.size()) {
+        size_t i = line;
+        while (i < data.size() && (data[i] == ' ' || data[i] == '\t')) ++i;
+        if (i < data.size() && data[i] >= '0' && data[i] <= '9') return line;
+        size_t nl = data.find('\n', line);
+        if (nl == std::string_view::npos) return std::string_view::npos;
+        line = nl + 1;
+    }
+    return std::string_view::npos;
+}
+
+inline void parseLine(std::string_view line, GameHeader& out) {
+    line = trim(line);
+    if (line.size() >= 4 && line.front() == '[' && line.back() == ']') {
+        size_t space = line.find(' ');
+        size_t open = line.find('"');
+        size_t close = line.rfind('"');
+        if (space != std::string_view::npos && open != std::string_view::npos && close > open) {
+            out.fields.emplace_back(std::string(line.substr(1, space - 1)),
+                                    std::string(line.substr(open + 1, close - open - 1)));
+        }
+        return;
+    }
+    if (line.empty() || line.front() == '#' || line.front() == '*') return;
+    static const std::string_view FULLWIDTH_COLON = "\xEF\xBC\x9A";  // ：
+    size_t colon = line.find(FULLWIDTH_COLON);
+    size_t sep = FULLWIDTH_COLON.size();
+    if (colon == std::string_view::npos) {
+        colon = line.find(':');
+        sep = 1;
+    }
+    if (colon == std::string_view::npos || colon == 0) return;
+    out.fields.emplace_back(std::string(trim(line.substr(0, colon))),
+                            std::string(trim(line.substr(colon + sep))));
+}
+
+}  // namespace game_header
+
+// Parse the header at the start of `data`, which may stop anywhere after
+// it; `complete` says whether `data` is the whole file
+inline void parseGameHeader(std::string_view data, bool complete, GameHeader& out) {
+    size_t end = game_header::headerEnd(data);
+    bool truncated = end == std::string_view::npos && !complete;
+    if (end != std::string_view::npos) data = data.substr(0, end);
+
+    std::string text = sjis::decodeText(data, truncated);
+    out.fields.clear();
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t nl = text.find('\n', pos);
+        if (nl == std::string::npos) {
+            if (truncated) break;  // partial last line
+            nl = text.size();
+        }
+        game_header::parseLine(std::string_view(text).substr(pos, nl - pos), out);
+        pos = nl + 1;
+    }
+}
+
+// Read the header of `name` in the directory `dirFd`; false if the file
+// could not be opened
+inline bool readGameHeader(int dirFd, const std::string& name, GameHeader& out) {
+    int fd = ::openat(dirFd, name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    std::string data;
+    size_t end = std::string::npos;
+    bool eof = false;
+    while (end == std::string::npos && !eof && data.size() < game_header::MAX_HEADER_BYTES) {
+        size_t old = data.size();
+        data.resize(old + game_header::CHUNK_BYTES);
+        ssize_t n = ::read(fd, &data[old], game_header::CHUNK_BYTES);
+        if (n < 0 && errno == EINTR) {
+            data.resize(old);
+            continue;
+        }
+        data.resize(old + static_cast<size_t>(n > 0 ? n : 0));
+        eof = n <= 0;
+        end = game_header::headerEnd(data);
+    }
+    ::close(fd);
+    parseGameHeader(data, eof, out);
+    return true;
+}
+
+// Last "まで…" line ("まで84手で後手の勝ち") in the final bytes of a KIF
+// file; `tail` must start at a line boundary. Empty if there is none.
+inline std::string kifConclusion(std::string_view tail) {
+    static const std::string MADE = "\xE3\x81\xBE\xE3\x81\xA7";  // まで
+    std::string text = sjis::decodeText(tail);
+    size_t at = text.rfind("\n" + MADE);
+    if (at == std::string::npos) {
+        if (text.compare(0, MADE.size(), MADE) != 0) return {};
+        at = 0;
+    } else {
+        ++at;
+    }
+    size_t end = text.find('\n', at);
+    return std::string(game_header::trim(std::string_view(text).substr(at, end == std::string::npos ? end : end - at)));
+}
+
+// Bytes of a KIF tail searched for the conclusion
+constexpr size_t CONCLUSION_BYTES = 2048;
+
+// Start of the last CONCLUSION_BYTES of `data`, moved to a line boundary
+// so no double-byte character is cut
+inline std::string_view conclusionTail(std::string_view data) {
+    if (data.size() <= CONCLUSION_BYTES) return data;
+    std::string_view tail = data.substr(data.size() - CONCLUSION_BYTES);
+    size_t nl = tail.find('\n');
+    return nl == std::string_view::npos ? std::string_view() : tail.substr(nl + 1);
+}
+
+// kifConclusion of the file `name` in `dirFd`, reading only its tail
+inline std::string readKifConclusion(int dirFd, const std::string& name) {
+    int fd = ::openat(dirFd, name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return {};
+    struct stat st;
+    std::string tail;
+    off_t start = 0;
+    if (::fstat(fd, &st) == 0) {
+        start = st.st_size > static_cast<off_t>(CONCLUSION_BYTES) ? st.st_size - CONCLUSION_BYTES : 0;
+        tail.resize(static_cast<size_t>(st.st_size - start));
+        ssize_t n = ::pread(fd, &tail[0], tail.size(), start);
+        tail.resize(n > 0 ? static_cast<size_t>(n) : 0);
+    }
+    ::close(fd);
+    if (start == 0) return kifConclusion(tail);
+    size_t nl = tail.find('\n');
+    return nl == std::string::npos ? std::string() : kifConclusion(std::string_view(tail).substr(nl + 1));
+}
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <algorithm>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+
+// 128-bit non-cryptographic hash (MurmurHash3 x64_128), usable in one shot
+// or streamed through Hasher128 for files that do not fit in one buffer.
+
+struct Hash128 {
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+
+    bool operator==(const Hash128& other) const { return lo == other.lo && hi == other.hi; }
+    bool operator!=(const Hash128& other) const { return !(*this == other); }
+    bool operator<(const Hash128& other) const {
+        return hi != other.hi ? hi < other.hi : lo < other.lo;
+    }
+
+    std::string hex() const {
+        static const char digits[] = "0123456789abcdef";
+        std::string out(32, '0');
+        for (int i = 0; i < 16; ++i) {
+            out[15 - i] = digits[(hi >> (i * 4)) & 0xf];
+            out[31 - i] = digits[(lo >> (i * 4)) & 0xf];
+        }
+        return out;
+    }
+};
+
+struct Hash128Hasher {
+    size_t operator()(const Hash128& h) const { return static_cast<size_t>(h.lo ^ (h.hi * 0x9e3779b97f4a7c15ULL)); }
+};
+
+class Hasher128 {
+public:
+    explicit Hasher128(uint64_t seed = 0) : h1_(seed), h2_(seed) {}
+
+    void update(const void* data, size_t len) {
+        const auto* p = static_cast<const uint8_t*>(data);
+        total_ += len;
+        if (pending_ > 0) {
+            size_t take = std::min(len, sizeof(buf_) - pending_);
+            std::memcpy(buf_ + pending_, p, take);
+            pending_ += take;
+            p += take;
+            len -= take;
+            if (pending_ < sizeof(buf_)) return;
+            block(buf_);
+            pending_ = 0;
+        }
+        while (len >= 16) {
+            block(p);
+            p += 16;
+            len -= 16;
+        }
+        if (len > 0) {
+            std::memcpy(buf_, p, len);
+            pending_ = len;
+        }
+    }
+
+    Hash128 finish() const {
+        uint64_t h1 = h1_, h2 = h2_;
+        uint64_t k1 = 0, k2 = 0;
+        const uint8_t* tail = buf_;
+        switch (pending_ & 15) {
+            case 15: k2 ^= uint64_t(tail[14]) << 48; [[fallthrough]];
+            case 14: k2 ^= uint64_t(tail[13]) << 40; [[fallthrough]];
+            case 13: k2 ^= uint64_t(tail[12]) << 32; [[fallthrough]];
+            case 12: k2 ^= uint64_t(tail[11]) << 24; [[fallthrough]];
+            case 11: k2 ^= uint64_t(tail[10]) << 16; [[fallthrough]];
+            case 10: k2 ^= uint64_t(tail[9]) << 8; [[fallthrough]];
+            case 9:
+                k2 ^= uint64_t(tail[8]);
+                k2 *= C2; k2 = rotl(k2, 33); k2 *= C1; h2 ^= k2;
+                [[fallthrough]];
+            case 8: k1 ^= uint64_t(tail[7]) << 56; [[fallthrough]];
+            case 7: k1 ^= uint64_t(tail[6]) << 48; [[fallthrough]];
+            case 6: k1 ^= uint64_t(tail[5]) << 40; [[fallthrough]];
+            case 5: k1 ^= uint64_t(tail[4]) << 32; [[fallthrough]];
+            case 4: k1 ^= uint64_t(tail[3]) << 24; [[fallthrough]];
+            case 3: k1 ^= uint64_t(tail[2]) << 16; [[fallthrough]];
+            case 2: k1 ^= uint64_t(tail[1]) << 8; [[fallthrough]];
+            case 1:
+                k1 ^= uint64_t(tail[0]);
+                k1 *= C1; k1 = rotl(k1, 31); k1 *= C2; h1 ^= k1;
+        }
+        h1 ^= total_;
+        h2 ^= total_;
+        h1 += h2;
+        h2 += h1;
+        h1 = fmix(h1);
+        h2 = fmix(h2);
+        h1 += h2;
+        h2 += h1;
+        return Hash128{h1, h2};
+    }
+
+private:
+    static constexpr uint64_t C1 = 0x87c37b91114253d5ULL;
+    static constexpr uint64_t C2 = 0x4cf5ad432745937fULL;
+
+    static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+    static uint64_t fmix(uint64_t k) {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ULL;
+        k ^= k >> 33;
+        return k;
+    }
+
+    void block(const uint8_t* p) {
+        uint64_t k1, k2;
+        std::memcpy(&k1, p, 8);
+        std::memcpy(&k2, p + 8, 8);
+
+        k1 *= C1; k1 = rotl(k1, 31); k1 *= C2; h1_ ^= k1;
+        h1_ = rotl(h1_, 27); h1_ += h2_; h1_ = h1_ * 5 + 0x52dce729;
+        k2 *= C2; k2 = rotl(k2, 33); k2 *= C1; h2_ ^= k2;
+        h2_ = rotl(h2_, 31); h2_ += h1_; h2_ = h2_ * 5 + 0x38495ab5;
+    }
+
+    uint64_t h1_;
+    uint64_t h2_;
+    uint64_t total_ = 0;
+    uint8_t buf_[16] = {};
+    size_t pending_ = 0;
+};
+
+// One-shot convenience wrapper
+inline Hash128 hash128(const void* data, size_t len, uint64_t seed = 0) {
+    Hasher128 h(seed);
+    h.update(data, len);
+    return h.finish();
+}
+
+inline Hash128 hash128(const std::string& s, uint64_t seed = 0) {
+    return hash128(s.data(), s.size(), seed);
+}
+
+// Size of the head and tail hashed by hashFileEdges
+constexpr uint64_t EDGE_BYTES = 4096;
+
+// Hash the whole content of a file; returns false if it could not be read
+inline bool hashFile(const std::filesystem::path& path, Hash128& out) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    Hasher128 hasher;
+    char buf[1 << 16];
+    ssize_t n;
+    while ((n = ::read(fd, buf, sizeof(buf))) > 0) {
+        hasher.update(buf, static_cast<size_t>(n));
+    }
+    ::close(fd);
+    if (n < 0) return false;
+    out = hasher.finish();
+    return true;
+}
+
+// Hash the first and last EDGE_BYTES of a file. Files no larger than
+// 2 * EDGE_BYTES are read whole, so the result is already the full hash.
+inline bool hashFileEdges(const std::filesystem::path& path, uint64_t size, Hash128& out) {
+    if (size <= 2 * EDGE_BYTES) return hashFile(path, out);
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    char buf[2 * EDGE_BYTES];
+    bool ok = ::pread(fd, buf, EDGE_BYTES, 0) == static_cast<ssize_t>(EDGE_BYTES) &&
+              ::pread(fd, buf + EDGE_BYTES, EDGE_BYTES, static_cast<off_t>(size - EDGE_BYTES)) ==
+                  static_cast<ssize_t>(EDGE_BYTES);
+    ::close(fd);
+    if (ok) out = hash128(buf, sizeof(buf));
+    return ok;
+}
@@ -0,0 +1,443 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "hash128.hpp"
+#include "move_plan.hpp"
+
+// Append-only journal of an organize_kif batch. Before anything moves, one
+// Intent record per planned move (absolute source and target, inode, size)
+// is written and fsynced in a single group commit. Completed moves append
+// Done records, buffered and written in batches; the final flush and the
+// Commit record share one more fsync. A journal without Commit belongs to
+// an interrupted batch. Done records only speed up recovery: the
+// filesystem is inspected anyway, so losing unsynced ones is harmless.
+// A Recorded record follows once the manifest and position index know
+// about the batch; without it, --recover redoes that bookkeeping.
+//
+// Layout: a 32-byte header (magic "KIFJRN01", writer pid, creation time),
+// then records of {uint32 type, uint32 length, uint64 check} followed by
+// `length` payload bytes. `check` is a hash of the payload seeded with the
+// type, so a torn tail is recognised and ignored.
+
+struct JournalEntry {
+    uint64_t id = 0;
+    uint64_t inode = 0;
+    uint64_t size = 0;
+    std::string source;
+    std::string target;
+    bool done = false;
+    bool undone = false;
+};
+
+struct JournalContents {
+    uint64_t pid = 0;
+    std::vector<JournalEntry> entries;  // indexed by id
+    bool committed = false;
+    bool recorded = false;   // manifest and position index are up to date
+    bool torn = false;       // trailing bytes that are not a complete record
+    uint64_t validBytes = 0;
+};
+
+class Journal {
+public:
+    enum Type : uint32_t { Intent = 1, Done = 2, Undone = 3, Commit = 4, Recorded = 5 };
+
+    Journal() = default;
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+    ~Journal() {
+        if (fd_ >= 0) ::close(fd_);
+    }
+
+    // Unique journal name for a new batch in `folder`
+    static std::filesystem::path newPath(const std::filesystem::path& folder) {
+        static std::atomic<unsigned> sequence{0};
+        return folder / ("organize_kif-" + std::to_string(::time(nullptr)) + "-" +
+                         std::to_string(::getpid()) + "-" + std::to_string(sequence++) + ".kifjrn");
+    }
+
+    // Start a new journal for `plan` and make its intents durable
+    bool create(const std::filesystem::path& path, const MovePlan& plan, std::string& error) {
+        std::vector<JournalEntry> entries(plan.moves.size());
+        std::filesystem::path source = std::filesystem::absolute(plan.source);
+        int srcFd = ::open(plan.source.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        for (size_t i = 0; i < plan.moves.size(); ++i) {
+            const PlannedMove& move = plan.moves[i];
+            struct stat st {};
+            if (srcFd >= 0) ::fstatat(srcFd, move.name.c_str(), &st, AT_SYMLINK_NOFOLLOW);
+            entries[i].id = i;
+            entries[i].inode = st.st_ino;
+            entries[i].size = static_cast<uint64_t>(st.st_size);
+            entries[i].source = (source / move.name).string();
+            entries[i].target = std::filesystem::absolute(plan.dirs[move.dir] / move.name).string();
+        }
+        if (srcFd >= 0) ::close(srcFd);
+        return create(path, entries, error);
+    }
+
+    // Start a new journal for arbitrary moves (absolute paths, id = index)
+    bool create(const std::filesystem::path& path, const std::vector<JournalEntry>& entries, std::string& error) {
+        std::error_code ec;
+        std::filesystem::create_directories(path.parent_path(), ec);
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644);
+        if (fd_ < 0) {
+            error = "Could not create journal " + path.string() + ": " + std::strerror(errno);
+            return false;
+        }
+        int dirFd = ::open(path.parent_path().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirFd >= 0) {
+            ::fsync(dirFd);  // the journal's name must survive a crash too
+            ::close(dirFd);
+        }
+        char header[32] = "KIFJRN01";
+        uint64_t pid = static_cast<uint64_t>(::getpid());
+        uint64_t created = static_cast<uint64_t>(::time(nullptr));
+        std::memcpy(header + 8, &pid, 8);
+        std::memcpy(header + 16, &created, 8);
+        buffer_.assign(header, sizeof(header));
+        for (const JournalEntry& entry : entries) {
+            appendIntent(entry.id, entry.inode, entry.size, entry.source, entry.target);
+        }
+        return sync(error);
+    }
+
+    // Reopen an existing journal for appending, dropping a torn tail
+    bool reopen(const std::filesystem::path& path, const JournalContents& contents, std::string& error) {
+        fd_ = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+        if (fd_ < 0 || (contents.torn && ::ftruncate(fd_, contents.validBytes) != 0)) {
+            error = "Could not open journal " + path.string() + ": " + std::strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    // Record a completed move; thread-safe, written in batches
+    void done(uint64_t id) { mark(Done, id); }
+    void undone(uint64_t id) { mark(Undone, id); }
+
+    // Write pending records plus a Commit record and fsync them together
+    bool commit(std::string& error) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        appendRecord(Commit, nullptr, 0);
+        return sync(error);
+    }
+
+    // Note that the batch's bookkeeping is done, after commit()
+    bool recorded(std::string& error) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        appendRecord(Recorded, nullptr, 0);
+        return sync(error);
+    }
+
+    // Write pending records and fsync them without closing the batch
+    bool flush(std::string& error) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return sync(error);
+    }
+
+    static bool read(const std::filesystem::path& path, JournalContents& out, std::string& error) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || ::fstat(fd, &st) != 0) {
+            error = "Could not open journal " + path.string() + ": " + std::strerror(errno);
+            if (fd >= 0) ::close(fd);
+            return false;
+        }
+        std::string data(static_cast<size_t>(st.st_size), '\0');
+        size_t got = 0;
+        while (got < data.size()) {
+            ssize_t n = ::read(fd, &data[got], data.size() - got);
+            if (n <= 0) break;
+            got += static_cast<size_t>(n);
+        }
+        ::close(fd);
+        data.resize(got);
+        if (data.size() < 32 || data.compare(0, 8, "KIFJRN01") != 0) {
+            error = path.string() + " is not an organize_kif journal";
+            return false;
+        }
+        std::memcpy(&out.pid, data.data() + 8, 8);
+
+        size_t pos = 32;
+        while (pos + 16 <= data.size()) {
+            uint32_t type, length;
+            uint64_t check;
+            std::memcpy(&type, data.data() + pos, 4);
+            std::memcpy(&length, data.data() + pos + 4, 4);
+            std::memcpy(&check, data.data() + pos + 8, 8);
+            if (length > data.size() - pos - 16) break;
+            const char* payload = data.data() + pos + 16;
+            if (hash128(payload, length, type).lo != check) break;
+            if (!apply(type, payload, length, out)) break;
+            pos += 16 + length;
+        }
+        out.validBytes = pos;
+        out.torn = pos != data.size();
+        return true;
+    }
+
+private:
+    // Flush the buffer once it holds this many bytes
+    static constexpr size_t BATCH_BYTES = 64 * 1024;
+
+    static bool apply(uint32_t type, const char* p, uint32_t length, JournalContents& out) {
+        uint64_t id;
+        if (type == Commit) {
+            out.committed = true;
+            return true;
+        }
+        if (type == Recorded) {
+            out.recorded = true;
+            return true;
+        }
+        if (length < 8) return false;
+        std::memcpy(&id, p, 8);
+        if (type == Intent) {
+            if (length < 32) return false;
+            JournalEntry entry;
+            uint32_t srcLen, dstLen;
+            entry.id = id;
+            std::memcpy(&entry.inode, p + 8, 8);
+            std::memcpy(&entry.size, p + 16, 8);
+            std::memcpy(&srcLen, p + 24, 4);
+            std::memcpy(&dstLen, p + 28, 4);
+            if (uint64_t(32) + srcLen + dstLen != length) return false;
+            entry.source.assign(p + 32, srcLen);
+            entry.target.assign(p + 32 + srcLen, dstLen);
+            if (out.entries.size() <= id) out.entries.resize(id + 1);
+            out.entries[id] = std::move(entry);
+            return true;
+        }
+        if (id >= out.entries.size()) return false;
+        if (type == Done) out.entries[id].done = true;
+        else if (type == Undone) out.entries[id].undone = true;
+        else return false;
+        return true;
+    }
+
+    void appendRecord(uint32_t type, const char* payload, uint32_t length) {
+        uint64_t check = hash128(payload, length, type).lo;
+        char header[16];
+        std::memcpy(header, &type, 4);
+        std::memcpy(header + 4, &length, 4);
+        std::memcpy(header + 8, &check, 8);
+        buffer_.append(header, sizeof(header));
+        buffer_.append(payload, length);
+    }
+
+    void appendIntent(uint64_t id, uint64_t inode, uint64_t size, const std::string& source,
+                      const std::string& target) {
+        std::string payload(32, '\0');
+        uint32_t srcLen = static_cast<uint32_t>(source.size());
+        uint32_t dstLen = static_cast<uint32_t>(target.size());
+        std::memcpy(&payload[0], &id, 8);
+        std::memcpy(&payload[8], &inode, 8);
+        std::memcpy(&payload[16], &size, 8);
+        std::memcpy(&payload[24], &srcLen, 4);
+        std::memcpy(&payload[28], &dstLen, 4);
+        payload += source;
+        payload += target;
+        appendRecord(Intent, payload.data(), static_cast<uint32_t>(payload.size()));
+    }
+
+    void mark(uint32_t type, uint64_t id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        appendRecord(type, reinterpret_cast<const char*>(&id), 8);
+        if (buffer_.size() >= BATCH_BYTES) writeBuffer();
+    }
+
+    // Append the buffer to the file; a failure is remembered for sync()
+    void writeBuffer() {
+        size_t off = 0;
+        while (off < buffer_.size() && writeError_ == 0) {
+            ssize_t n = ::write(fd_, buffer_.data() + off, buffer_.size() - off);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) writeError_ = errno;
+            else off += static_cast<size_t>(n);
+        }
+        buffer_.clear();
+    }
+
+    bool sync(std::string& error) {
+        writeBuffer();
+        if (writeError_ == 0 && ::fdatasync(fd_) != 0) writeError_ = errno;
+        if (writeError_ != 0) {
+            error = std::string("Could not write journal: ") + std::strerror(writeError_);
+            return false;
+        }
+        return true;
+    }
+
+    int fd_ = -1;
+    int writeError_ = 0;
+    std::mutex mutex_;
+    std::string buffer_;
+};
+
+// Where a journaled move stands on disk
+enum class EntryState {
+    Pending,   // only the source exists
+    Moved,     // only the target exists, or the target is the source's inode
+    Copied,    // cross-device copy finished but the identical source remains
+    Conflict,  // both exist and differ, or the target is another file
+    Missing,   // neither exists
+};
+
+// Whether `dst` (the target, with the source gone) is the file the Intent
+// recorded: the same inode and size, or for a cross-device move, which
+// gives the copy a new inode, the same size on another filesystem than the
+// source's. Intents written without an inode are taken on trust.
+inline bool isMovedFile(const JournalEntry& entry, const struct stat& dst) {
+    if (entry.inode == 0) return true;
+    if (static_cast<uint64_t>(dst.st_size) != entry.size) return false;
+    if (dst.st_ino == entry.inode) return true;
+    std::filesystem::path dir = std::filesystem::path(entry.source).parent_path();
+    struct stat st;
+    while (::stat(dir.c_str(), &st) != 0) {
+        if (!dir.has_relative_path()) return false;
+        dir = dir.parent_path();
+    }
+    return st.st_dev != dst.st_dev;
+}
+
+inline EntryState inspectEntry(const JournalEntry& entry) {
+    struct stat src, dst;
+    bool hasSource = ::lstat(entry.source.c_str(), &src) == 0;
+    bool hasTarget = ::lstat(entry.target.c_str(), &dst) == 0;
+    if (!hasTarget) return hasSource ? EntryState::Pending : EntryState::Missing;
+    if (!hasSource) return isMovedFile(entry, dst) ? EntryState::Moved : EntryState::Conflict;
+    if (src.st_ino == dst.st_ino && src.st_dev == dst.st_dev) return EntryState::Moved;
+    Hash128 a, b;
+    if (static_cast<uint64_t>(dst.st_size) == static_cast<uint64_t>(src.st_size) &&
+        hashFile(entry.source, a) && hashFile(entry.target, b) && a == b) {
+        return EntryState::Copied;
+    }
+    return EntryState::Conflict;
+}
+
+// Move every completed entry of a journal back to its source, in parallel,
+// and record each as Undone so a repeated undo skips it. The entries moved
+// back are returned in `restored` for the caller's bookkeeping.
+inline MoveReport undoJournal(const std::filesystem::path& path, unsigned jobs, std::vector<JournalEntry>& restored) {
+    MoveReport report;
+    restored.clear();
+    JournalContents contents;
+    Journal journal;
+    std::string error;
+    if (!Journal::read(path, contents, error) || !journal.reopen(path, contents, error)) {
+        report.errors.push_back(error);
+        return report;
+    }
+    // In a committed journal, entries without Done never moved
+    std::vector<const JournalEntry*> todo;
+    for (const auto& entry : contents.entries) {
+        if (!entry.undone && !entry.source.empty() && (entry.done || !contents.committed)) todo.push_back(&entry);
+    }
+    std::vector<std::string> errors(todo.size());
+    std::vector<char> undone(todo.size(), 0);
+    parallelFor(todo.size(), jobs, [&](size_t k) {
+        const JournalEntry& entry = *todo[k];
+        EntryState state = inspectEntry(entry);
+        if (state == EntryState::Pending) return;  // never moved
+        if (state == EntryState::Missing) {
+            errors[k] = "Neither " + entry.source + " nor " + entry.target + " exists";
+            return;
+        }
+        if (state == EntryState::Conflict) {
+            errors[k] = ::access(entry.source.c_str(), F_OK) == 0
+                            ? "Source exists again, not undoing: " + entry.source
+                            : "Target is not the file this batch moved, not undoing: " + entry.target;
+            return;
+        }
+        if (state == EntryState::Copied) {
+            if (::unlink(entry.target.c_str()) != 0) {
+                errors[k] = "Could not remove " + entry.target + ": " + std::strerror(errno);
+                return;
+            }
+        } else {
+            std::error_code ec;
+            std::filesystem::create_directories(std::filesystem::path(entry.source).parent_path(), ec);
+            if (!moveFile(entry.target, entry.source, errors[k])) return;
+        }
+        undone[k] = 1;
+        journal.undone(entry.id);
+    });
+    for (size_t k = 0; k < todo.size(); ++k) {
+        if (undone[k]) {
+            ++report.moved;
+            restored.push_back(*todo[k]);
+        }
+        if (!errors[k].empty()) report.errors.push_back(errors[k]);
+    }
+    if (!journal.commit(error)) report.errors.push_back(error);
+    return report;
+}
+
+// Complete an interrupted batch: finish pending moves, drop sources whose
+// cross-device copy had already landed, remove stale temporary copies of
+// the crashed writer, then commit the journal
+inline MoveReport recoverJournal(const std::filesystem::path& path, unsigned jobs) {
+    MoveReport report;
+    JournalContents contents;
+    Journal journal;
+    std::string error;
+    if (!Journal::read(path, contents, error) || !journal.reopen(path, contents, error)) {
+        report.errors.push_back(error);
+        return report;
+    }
+    std::vector<const JournalEntry*> todo;
+    for (const auto& entry : contents.entries) {
+        if (!entry.done && !entry.undone && !entry.source.empty()) todo.push_back(&entry);
+    }
+    std::vector<std::string> errors(todo.size());
+    std::vector<char> moved(todo.size(), 0);
+    parallelFor(todo.size(), jobs, [&](size_t k) {
+        const JournalEntry& entry = *todo[k];
+        std::filesystem::path target(entry.target);
+        std::filesystem::path stale = target.parent_path() /
+            ("." + target.filename().string() + ".kifmove-" + std::to_string(contents.pid));
+        ::unlink(stale.c_str());
+
+        switch (inspectEntry(entry)) {
+            case EntryState::Moved:
+                break;
+            case EntryState::Copied:
+                if (::unlink(entry.source.c_str()) != 0) {
+                    errors[k] = "Could not remove " + entry.source + ": " + std::strerror(errno);
+                    return;
+                }
+                break;
+            case EntryState::Pending: {
+                std::error_code ec;
+                std::filesystem::create_directories(target.parent_path(), ec);
+                if (!moveFile(entry.source, target, errors[k])) return;
+                break;
+            }
+            case EntryState::Conflict:
+                errors[k] = "Target already exists, skipping: " + entry.target;
+                return;
+            case EntryState::Missing:
+                errors[k] = "Neither " + entry.source + " nor " + entry.target + " exists";
+                return;
+        }
+        moved[k] = 1;
+        journal.done(entry.id);
+    });
+    for (size_t k = 0; k < todo.size(); ++k) {
+        if (moved[k]) ++report.moved;
+        if (!errors[k].empty()) report.errors.push_back(errors[k]);
+    }
+    if (!journal.commit(error)) report.errors.push_back(error);
+    return report;
+}
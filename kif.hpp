@@ -0,0 +1,406 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sjis.hpp"
+
+// Zero-copy KIF parser. A KifFile maps the file read-only and kif::parse
+// fills a Record of string_views into that mapping: header fields, the
+// rows of a starting diagram, the moves of the main line and the '*'
+// comment lines that follow each move. Nothing is decoded or copied; views
+// keep the file's own encoding (CP932 or UTF-8, detected from the first
+// 4 KiB) and Record::text() decodes one on demand. Move tokens such as
+// "７六歩(77)", "同　銀成(45)" and "５五角打" are parsed character by
+// character in either encoding. Engine analysis ("**解析" lines) makes up
+// most of an annotated file and is skipped with memchr, one line at a
+// time, without looking inside.
+
+namespace kif {
+
+enum Piece : uint8_t {
+    NoPiece, Pawn, Lance, Knight, Silver, Gold, Bishop, Rook, King,
+    ProPawn, ProLance, ProKnight, ProSilver, Horse, Dragon
+};
+
+enum class Encoding : uint8_t { Cp932, Utf8 };
+
+struct Field {
+    std::string_view key;
+    std::string_view value;
+};
+
+struct Move {
+    uint16_t ply = 0;
+    uint8_t to = 0;           // file * 10 + rank (77 = ７七); 0 for 投了 and other specials
+    uint8_t from = 0;         // same encoding; 0 for a drop
+    Piece piece = NoPiece;    // piece as written, before this move's promotion
+    bool promote = false;     // 成 (不成 leaves it false)
+    bool drop = false;        // 打
+    bool same = false;        // 同: `to` repeats the previous move's square
+    int32_t seconds = -1;     // time spent on the move, -1 if not recorded
+    int32_t total = -1;       // the mover's cumulative time, -1 if not recorded
+    std::string_view text;    // the move token, e.g. "７六歩(77)" or "投了"
+    std::string_view comments;  // the '*' lines after the move, newlines included
+
+    bool special() const { return piece == NoPiece; }
+};
+
+struct Record {
+    Encoding encoding = Encoding::Cp932;
+    std::vector<Field> headers;  // in file order
+    std::string_view comments;   // '*' lines before the first move
+    std::vector<Move> moves;     // main line only
+    bool variations = false;     // the file has 変化 branches after the main line
+    std::string_view board;      // "|...|" rows of a starting diagram, empty without one
+    bool goteToMove = false;     // 後手番 (or 上手番) follows the diagram
+
+    // Header value for a UTF-8 key such as "先手", or nullptr
+    const std::string_view* find(std::string_view key) const;
+
+    // UTF-8 copy of a view into this record
+    std::string text(std::string_view raw) const {
+        return encoding == Encoding::Utf8 ? std::string(raw) : sjis::toUtf8(raw);
+    }
+
+    // The same into a reused buffer; a UTF-8 record's view is returned as is
+    std::string_view text(std::string_view raw, std::string& buffer) const {
+        if (encoding == Encoding::Utf8) return raw;
+        sjis::toUtf8(raw, buffer);
+        return buffer;
+    }
+};
+
+// Read-only mapping of a whole file
+class KifFile {
+public:
+    KifFile() = default;
+    KifFile(const KifFile&) = delete;
+    KifFile& operator=(const KifFile&) = delete;
+    ~KifFile() { close(); }
+
+    bool open(const std::filesystem::path& path, std::string& error) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || ::fstat(fd, &st) != 0) {
+            error = "cannot open " + path.string() + ": " + std::strerror(errno);
+            if (fd >= 0) ::close(fd);
+            return false;
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ > 0) {
+            void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                error = "cannot map " + path.string() + ": " + std::strerror(errno);
+                size_ = 0;
+                ::close(fd);
+                return false;
+            }
+            ::madvise(p, size_, MADV_SEQUENTIAL);
+            base_ = p;
+        }
+        ::close(fd);
+        return true;
+    }
+
+    void close() {
+        if (base_) ::munmap(base_, size_);
+        base_ = nullptr;
+        size_ = 0;
+    }
+
+    std::string_view data() const { return {static_cast<const char*>(base_), size_}; }
+
+private:
+    void* base_ = nullptr;
+    size_t size_ = 0;
+};
+
+namespace detail {
+
+// Code points used in move tokens
+constexpr uint32_t IDEOGRAPHIC_SPACE = 0x3000, FULLWIDTH_COLON = 0xFF1A;
+constexpr uint32_t SAME = 0x540C, PROMOTE = 0x6210, NOT = 0x4E0D, DROP = 0x6253, CHANGE = 0x5909;
+constexpr uint32_t GOTE = 0x5F8C, UWATE = 0x4E0A, TE = 0x624B, BAN = 0x756A;  // 後 上 手 番
+
+inline uint32_t decodeUtf8(std::string_view in, size_t& i) {
+    uint8_t b = static_cast<uint8_t>(in[i++]);
+    if (b < 0x80) return b;
+    size_t len = b >= 0xF0 ? 3 : b >= 0xE0 ? 2 : b >= 0xC0 ? 1 : 0;
+    if (len == 0 || i + len > in.size()) return 0xFFFD;
+    uint32_t cp = b & (0x3F >> len);
+    for (size_t k = 0; k < len; ++k) cp = (cp << 6) | (static_cast<uint8_t>(in[i++]) & 0x3F);
+    return cp;
+}
+
+inline uint32_t next(Encoding enc, std::string_view in, size_t& i) {
+    if (i >= in.size()) return 0;
+    return enc == Encoding::Utf8 ? decodeUtf8(in, i) : sjis::decodeChar(in, i);
+}
+
+// 1-9 for a full-width or ASCII digit, 0 otherwise
+inline int fileDigit(uint32_t cp) {
+    if (cp >= 0xFF11 && cp <= 0xFF19) return static_cast<int>(cp - 0xFF10);
+    if (cp >= '1' && cp <= '9') return static_cast<int>(cp - '0');
+    return 0;
+}
+
+// 1-9 for a kanji numeral 一..九, 0 otherwise
+inline int rankDigit(uint32_t cp) {
+    switch (cp) {
+        case 0x4E00: return 1;  // 一
+        case 0x4E8C: return 2;  // 二
+        case 0x4E09: return 3;  // 三
+        case 0x56DB: return 4;  // 四
+        case 0x4E94: return 5;  // 五
+        case 0x516D: return 6;  // 六
+        case 0x4E03: return 7;  // 七
+        case 0x516B: return 8;  // 八
+        case 0x4E5D: return 9;  // 九
+        default: return fileDigit(cp);
+    }
+}
+
+inline Piece pieceOf(uint32_t cp) {
+    switch (cp) {
+        case 0x6B69: return Pawn;       // 歩
+        case 0x9999: return Lance;      // 香
+        case 0x6842: return Knight;     // 桂
+        case 0x9280: return Silver;     // 銀
+        case 0x91D1: return Gold;       // 金
+        case 0x89D2: return Bishop;     // 角
+        case 0x98DB: return Rook;       // 飛
+        case 0x7389: case 0x738B: return King;  // 玉 王
+        case 0x3068: return ProPawn;    // と
+        case 0x674F: return ProLance;   // 杏
+        case 0x572D: return ProKnight;  // 圭
+        case 0x5168: return ProSilver;  // 全
+        case 0x99AC: return Horse;      // 馬
+        case 0x9F8D: case 0x7ADC: return Dragon;  // 龍 竜
+        default: return NoPiece;
+    }
+}
+
+inline Piece promoted(Piece p) {
+    switch (p) {
+        case Lance: return ProLance;
+        case Knight: return ProKnight;
+        case Silver: return ProSilver;
+        default: return NoPiece;
+    }
+}
+
+inline std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r')) s.remove_suffix(1);
+    return s;
+}
+
+// Parse "m:ss/hh:mm:ss" (spaces allowed) into seconds
+inline void parseTime(std::string_view s, Move& move) {
+    int32_t parts[5] = {0, 0, 0, 0, 0};
+    size_t count = 0;
+    bool digits = false;
+    for (char c : s) {
+        if (c >= '0' && c <= '9') {
+            parts[count] = parts[count] * 10 + (c - '0');
+            digits = true;
+        } else if ((c == ':' || c == '/') && digits) {
+            if (++count == 5) return;
+            digits = false;
+        } else if (c != ' ') {
+            return;
+        }
+    }
+    if (count != 4 || !digits) return;
+    move.seconds = parts[0] * 60 + parts[1];
+    move.total = parts[2] * 3600 + parts[3] * 60 + parts[4];
+}
+
+// Parse the part of a move line after the ply number
+inline void parseMove(Encoding enc, std::string_view rest, const Move* previous, Move& move) {
+    size_t tokenEnd = rest.find_first_of(" \t(");
+    size_t paren = rest.find('(');
+    // The from-square "(77)" belongs to the token; the time "( 0:01/...)" does not
+    if (paren != std::string_view::npos && paren == tokenEnd && paren + 3 < rest.size() && rest[paren + 3] == ')' &&
+        rest[paren + 1] >= '1' && rest[paren + 1] <= '9') {
+        tokenEnd = paren + 4;
+    }
+    move.text = rest.substr(0, tokenEnd);
+    if (tokenEnd != std::string_view::npos) {
+        size_t open = rest.find('(', tokenEnd);
+        size_t close = open == std::string_view::npos ? open : rest.find(')', open);
+        if (close != std::string_view::npos) parseTime(rest.substr(open + 1, close - open - 1), move);
+    }
+
+    std::string_view token = move.text;
+    size_t i = 0;
+    uint32_t cp = next(enc, token, i);
+    if (cp == SAME) {
+        if (!previous || previous->to == 0) return;
+        move.same = true;
+        move.to = previous->to;
+        size_t j = i;
+        if (next(enc, token, j) == IDEOGRAPHIC_SPACE) i = j;
+    } else {
+        int file = fileDigit(cp);
+        int rank = rankDigit(next(enc, token, i));
+        if (file == 0 || rank == 0) return;
+        move.to = static_cast<uint8_t>(file * 10 + rank);
+    }
+
+    cp = next(enc, token, i);
+    Piece piece = pieceOf(cp);
+    if (cp == PROMOTE) piece = promoted(pieceOf(next(enc, token, i)));  // 成香 成桂 成銀
+    if (piece == NoPiece) {
+        move.to = 0;
+        move.same = false;
+        return;
+    }
+    move.piece = piece;
+
+    while (i < token.size()) {
+        size_t at = i;
+        cp = next(enc, token, i);
+        if (cp == PROMOTE) {
+            move.promote = true;
+        } else if (cp == NOT) {
+            next(enc, token, i);  // 不成
+        } else if (cp == DROP) {
+            move.drop = true;
+        } else if (cp == '(') {
+            std::string_view from = token.substr(at + 1);
+            if (from.size() >= 3 && from[2] == ')') move.from = static_cast<uint8_t>((from[0] - '0') * 10 + (from[1] - '0'));
+            break;
+        }
+    }
+}
+
+// Offset of a full-width colon in `line`, on a character boundary
+inline size_t findColon(Encoding enc, std::string_view line) {
+    size_t i = 0;
+    while (i < line.size()) {
+        size_t at = i;
+        if (next(enc, line, i) == FULLWIDTH_COLON) return at;
+    }
+    return std::string_view::npos;
+}
+
+// True if a CP932 key reads the same as a UTF-8 one, decoding as it goes
+inline bool sameKey(std::string_view cp932, std::string_view utf8) {
+    size_t i = 0, k = 0;
+    while (i < cp932.size() && k < utf8.size()) {
+        if (sjis::decodeChar(cp932, i) != decodeUtf8(utf8, k)) return false;
+    }
+    return i == cp932.size() && k == utf8.size();
+}
+
+}  // namespace detail
+
+inline const std::string_view* Record::find(std::string_view key) const {
+    for (const auto& field : headers) {
+        if (encoding == Encoding::Utf8 ? field.key == key : detail::sameKey(field.key, key)) return &field.value;
+    }
+    return nullptr;
+}
+
+// Parse a whole KIF. Returns false with `error` set if the main line is
+// malformed (a ply out of sequence); the record then holds what was read.
+inline bool parse(std::string_view data, Record& out, std::string& error) {
+    // Start from an empty record but keep the capacity of `out`'s vectors,
+    // so parsing game after game into one Record stops allocating
+    std::vector<Field> headers = std::move(out.headers);
+    std::vector<Move> moves = std::move(out.moves);
+    headers.clear();
+    moves.clear();
+    out = Record();
+    out.headers = std::move(headers);
+    out.moves = std::move(moves);
+    if (data.substr(0, 3) == "\xEF\xBB\xBF") {
+        data.remove_prefix(3);
+        out.encoding = Encoding::Utf8;
+    } else {
+        bool utf8 = sjis::detect(data.substr(0, 4096), true) == sjis::Encoding::Utf8;
+        out.encoding = utf8 ? Encoding::Utf8 : Encoding::Cp932;
+    }
+    const Encoding enc = out.encoding;
+
+    // Comment lines extend the span of the last move (or of the game)
+    auto addComment = [&](std::string_view line, size_t end) {
+        std::string_view& span = out.moves.empty() ? out.comments : out.moves.back().comments;
+        if (span.empty()) {
+            span = line;
+        } else {
+            span = std::string_view(span.data(), static_cast<size_t>(data.data() + end - span.data()));
+        }
+    };
+
+    size_t pos = 0, lineNo = 0;
+    while (pos < data.size()) {
+        const char* nl = static_cast<const char*>(std::memchr(data.data() + pos, '\n', data.size() - pos));
+        size_t end = nl ? static_cast<size_t>(nl - data.data()) : data.size();
+        std::string_view line = data.substr(pos, end - pos);
+        pos = end + 1;
+        ++lineNo;
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        if (line.empty()) continue;
+
+        char first = line[0];
+        if (first == '*') {
+            addComment(line, end);
+            continue;
+        }
+        if (first == '#' || first == '&') continue;
+
+        size_t i = line.find_first_not_of(' ');
+        if (i == std::string_view::npos) continue;
+        if (line[i] >= '0' && line[i] <= '9') {
+            unsigned ply = 0;
+            while (i < line.size() && line[i] >= '0' && line[i] <= '9') ply = ply * 10 + static_cast<unsigned>(line[i++] - '0');
+            if (ply != out.moves.size() + 1) {
+                error = "line " + std::to_string(lineNo) + ": move " + std::to_string(ply) + " out of sequence";
+                return false;
+            }
+            Move move;
+            move.ply = static_cast<uint16_t>(ply);
+            detail::parseMove(enc, detail::trim(line.substr(i)), out.moves.empty() ? nullptr : &out.moves.back(), move);
+            out.moves.push_back(move);
+            continue;
+        }
+
+        size_t k = 0;
+        if (detail::next(enc, line, k) == detail::CHANGE) {  // 変化：N手
+            out.variations = true;
+            break;
+        }
+        if (!out.moves.empty()) continue;
+        if (first == '|') {  // a row of the starting diagram
+            out.board = out.board.empty() ? line
+                                          : std::string_view(out.board.data(), static_cast<size_t>(line.data() + line.size() - out.board.data()));
+            continue;
+        }
+        k = 0;
+        uint32_t who = detail::next(enc, line, k);
+        if ((who == detail::GOTE || who == detail::UWATE) && detail::next(enc, line, k) == detail::TE &&
+            detail::next(enc, line, k) == detail::BAN) {
+            out.goteToMove = true;
+            continue;
+        }
+        size_t colon = detail::findColon(enc, line);
+        if (colon == std::string_view::npos || colon == 0) continue;  // board diagram, "手数----指手--"
+        size_t sep = enc == Encoding::Utf8 ? 3 : 2;
+        out.headers.push_back({detail::trim(line.substr(0, colon)), detail::trim(line.substr(colon + sep))});
+    }
+    return true;
+}
+
+}  // namespace kif
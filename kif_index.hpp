@@ -0,0 +1,440 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <filesystem>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hash128.hpp"
+#include "parallel.hpp"
+
+// Persistent index of a reference folder, stored next to it as
+// .<folder>.kifidx. The file is memory-mapped and holds:
+//
+//   Header
+//   DirRecord[dirCount]     every directory, with its mtime
+//   FileRecord[fileCount]   files grouped by directory: size, mtime, hashes
+//   uint32_t slots[4][slotCount]
+//                           open-addressing tables (file index + 1, 0 = empty)
+//                           keyed by name, size, size+edge hash, size+full hash
+//   char strings[]          directory paths and file names
+//
+// On refresh every directory and file is stat'ed, but only directories
+// whose mtime changed are listed again; files are re-hashed only when
+// their size or mtime differ from the record (a file edited in place keeps
+// its directory's mtime). Lookups probe the mapped tables.
+
+class KifIndex {
+public:
+    struct DirRecord {
+        int64_t mtimeNs;
+        uint32_t parent;  // NO_PARENT for the root
+        uint32_t pathOff;
+        uint32_t pathLen;
+        uint32_t firstFile;
+        uint32_t fileCount;
+        uint32_t reserved;
+    };
+
+    struct FileRecord {
+        uint64_t size;
+        int64_t mtimeNs;
+        Hash128 edge;
+        Hash128 full;
+        uint64_t nameHash;
+        uint32_t dir;
+        uint32_t nameOff;
+        uint32_t nameLen;
+        uint32_t reserved;
+    };
+
+    struct RefreshStats {
+        size_t dirs = 0;
+        size_t dirsRescanned = 0;
+        size_t files = 0;
+        size_t filesHashed = 0;
+    };
+
+    static constexpr uint32_t NO_PARENT = 0xffffffffu;
+
+    KifIndex() = default;
+    KifIndex(const KifIndex&) = delete;
+    KifIndex& operator=(const KifIndex&) = delete;
+    ~KifIndex() { unmap(); }
+
+    // Location of the index file for a folder
+    static std::filesystem::path pathFor(const std::filesystem::path& folder) {
+        std::filesystem::path abs = std::filesystem::absolute(folder).lexically_normal();
+        if (!abs.has_filename()) abs = abs.parent_path();
+        return abs.parent_path() / ("." + abs.filename().string() + ".kifidx");
+    }
+
+    // Bring the index of `folder` up to date, rewrite it if anything
+    // changed, and map it for lookups
+    bool open(const std::filesystem::path& folder, unsigned threads, std::string& error) {
+        root_ = folder;
+        std::filesystem::path file = pathFor(folder);
+        map(file);
+
+        Builder b;
+        stats_ = RefreshStats{};
+        scanDir(b, "", NO_PARENT);
+        parallelFor(b.toHash.size(), threads, [&](size_t k) {
+            FileRecord& f = b.files[b.toHash[k]];
+            std::filesystem::path p = root_ / b.dirPath(f.dir) / b.name(f);
+            if (!hashFileEdges(p, f.size, f.edge)) f.size = UINT64_MAX;
+            if (f.size <= 2 * EDGE_BYTES) f.full = f.edge;
+            else if (f.size != UINT64_MAX && !hashFile(p, f.full)) f.size = UINT64_MAX;
+        });
+        stats_.dirs = b.dirs.size();
+        stats_.files = b.files.size();
+        stats_.filesHashed = b.toHash.size();
+
+        if (valid() && stats_.dirsRescanned == 0 && b.toHash.empty() && b.files.size() == header()->fileCount) {
+            return true;
+        }
+        unmap();
+        if (!write(b, file, error)) return false;
+        if (!map(file)) {
+            error = "cannot map " + file.string();
+            return false;
+        }
+        return true;
+    }
+
+    const RefreshStats& stats() const { return stats_; }
+    size_t fileCount() const { return valid() ? header()->fileCount : 0; }
+
+    // First file with this name, or nullptr
+    const FileRecord* findName(std::string_view name) const {
+        uint64_t key = hash128(name.data(), name.size()).lo;
+        return probe(TABLE_NAME, key, [&](const FileRecord& f) {
+            return f.nameHash == key && this->name(f) == name;
+        });
+    }
+
+    bool hasSize(uint64_t size) const {
+        return probe(TABLE_SIZE, size, [&](const FileRecord& f) { return f.size == size; }) != nullptr;
+    }
+
+    const FileRecord* findEdge(uint64_t size, const Hash128& edge) const {
+        return probe(TABLE_EDGE, mix(size, edge), [&](const FileRecord& f) {
+            return f.size == size && f.edge == edge;
+        });
+    }
+
+    const FileRecord* findFull(uint64_t size, const Hash128& full) const {
+        return probe(TABLE_FULL, mix(size, full), [&](const FileRecord& f) {
+            return f.size == size && f.full == full;
+        });
+    }
+
+    std::string_view name(const FileRecord& f) const { return {strings() + f.nameOff, f.nameLen}; }
+
+    std::filesystem::path filePath(const FileRecord& f) const {
+        const DirRecord& d = dirs()[f.dir];
+        return root_ / std::string_view(strings() + d.pathOff, d.pathLen) / name(f);
+    }
+
+    // Whether the file behind a record still has the recorded size and
+    // mtime; files edited in place do not touch their directory's mtime
+    bool stillValid(const FileRecord& f) const {
+        struct stat st;
+        return ::stat(filePath(f).c_str(), &st) == 0 && static_cast<uint64_t>(st.st_size) == f.size &&
+               mtimeNs(st) == f.mtimeNs;
+    }
+
+private:
+    struct Header {
+        char magic[8];
+        uint64_t dirCount;
+        uint64_t fileCount;
+        uint64_t slotCount;
+        uint64_t stringsSize;
+        uint64_t reserved[3];
+    };
+
+    enum Table { TABLE_NAME, TABLE_SIZE, TABLE_EDGE, TABLE_FULL, TABLE_COUNT };
+
+    static constexpr char MAGIC[8] = {'K', 'I', 'F', 'I', 'D', 'X', '0', '1'};
+
+    // Index contents being assembled in memory before they are written
+    struct Builder {
+        std::vector<DirRecord> dirs;
+        std::vector<FileRecord> files;
+        std::vector<size_t> toHash;
+        std::string strings;
+
+        uint32_t addString(std::string_view s) {
+            uint32_t off = static_cast<uint32_t>(strings.size());
+            strings.append(s);
+            return off;
+        }
+        std::string_view dirPath(uint32_t d) const { return {strings.data() + dirs[d].pathOff, dirs[d].pathLen}; }
+        std::string_view name(const FileRecord& f) const { return {strings.data() + f.nameOff, f.nameLen}; }
+    };
+
+    static int64_t mtimeNs(const struct stat& st) {
+        return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    }
+
+    static uint64_t mix(uint64_t size, const Hash128& h) {
+        return h.lo ^ (h.hi * 0x9e3779b97f4a7c15ULL) ^ (size * 0xc2b2ae3d27d4eb4fULL);
+    }
+
+    bool valid() const { return base_ != nullptr; }
+    const Header* header() const { return static_cast<const Header*>(base_); }
+    const DirRecord* dirs() const { return reinterpret_cast<const DirRecord*>(header() + 1); }
+    const FileRecord* files() const { return reinterpret_cast<const FileRecord*>(dirs() + header()->dirCount); }
+    const uint32_t* slots(Table t) const {
+        return reinterpret_cast<const uint32_t*>(files() + header()->fileCount) + t * header()->slotCount;
+    }
+    const char* strings() const { return reinterpret_cast<const char*>(slots(TABLE_COUNT)); }
+
+    static size_t fileSize(uint64_t dirs, uint64_t files, uint64_t slotCount, uint64_t stringsSize) {
+        return sizeof(Header) + dirs * sizeof(DirRecord) + files * sizeof(FileRecord) +
+               TABLE_COUNT * slotCount * sizeof(uint32_t) + stringsSize;
+    }
+
+    template <typename Match>
+    const FileRecord* probe(Table t, uint64_t key, Match match) const {
+        if (!valid() || header()->slotCount == 0) return nullptr;
+        const uint32_t* table = slots(t);
+        uint64_t mask = header()->slotCount - 1;
+        for (uint64_t i = key & mask;; i = (i + 1) & mask) {
+            uint32_t slot = table[i];
+            if (slot == 0) return nullptr;
+            const FileRecord& f = files()[slot - 1];
+            if (match(f)) return &f;
+        }
+    }
+
+    // Record directory `rel` (relative to the root) and everything below it
+    void scanDir(Builder& b, const std::string& rel, uint32_t parent) {
+        std::filesystem::path full = rel.empty() ? root_ : root_ / rel;
+        struct stat st;
+        if (::stat(full.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) return;
+
+        uint32_t old = findOldDir(rel);
+        uint32_t self = static_cast<uint32_t>(b.dirs.size());
+        DirRecord d{};
+        d.mtimeNs = mtimeNs(st);
+        d.parent = parent;
+        d.pathOff = b.addString(rel);
+        d.pathLen = static_cast<uint32_t>(rel.size());
+        d.firstFile = static_cast<uint32_t>(b.files.size());
+        b.dirs.push_back(d);
+
+        std::vector<std::string> subdirs;
+        if (old != NO_PARENT && dirs()[old].mtimeNs == d.mtimeNs) {
+            // Unchanged directory: reuse its file list and subdirectories.
+            // Editing a file in place leaves the directory's mtime alone,
+            // so every file is still stat'ed and re-hashed if it changed.
+            const DirRecord& o = dirs()[old];
+            int fd = ::open(full.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            for (uint32_t i = 0; i < o.fileCount; ++i) {
+                FileRecord f = files()[o.firstFile + i];
+                std::string_view n = name(files()[o.firstFile + i]);
+                struct stat fst;
+                if (fd < 0 || ::fstatat(fd, std::string(n).c_str(), &fst, 0) != 0 || !S_ISREG(fst.st_mode)) continue;
+                if (static_cast<uint64_t>(fst.st_size) != f.size || mtimeNs(fst) != f.mtimeNs) {
+                    f.size = static_cast<uint64_t>(fst.st_size);
+                    f.mtimeNs = mtimeNs(fst);
+                    b.toHash.push_back(b.files.size());
+                }
+                f.dir = self;
+                f.nameOff = b.addString(n);
+                b.files.push_back(f);
+            }
+            if (fd >= 0) ::close(fd);
+            for (uint32_t i : oldChildren_[old]) {
+                subdirs.emplace_back(strings() + dirs()[i].pathOff, dirs()[i].pathLen);
+            }
+        } else {
+            ++stats_.dirsRescanned;
+            listDir(b, full, self, old, subdirs);
+        }
+        b.dirs[self].fileCount = static_cast<uint32_t>(b.files.size()) - b.dirs[self].firstFile;
+
+        for (const std::string& sub : subdirs) {
+            scanDir(b, sub, self);
+        }
+    }
+
+    uint32_t findOldDir(const std::string& rel) {
+        if (!valid()) return NO_PARENT;
+        if (oldDirs_.empty()) {
+            oldChildren_.assign(header()->dirCount, {});
+            for (uint32_t i = 0; i < header()->dirCount; ++i) {
+                oldDirs_.emplace(std::string_view(strings() + dirs()[i].pathOff, dirs()[i].pathLen), i);
+                if (dirs()[i].parent != NO_PARENT) oldChildren_[dirs()[i].parent].push_back(i);
+            }
+        }
+        auto it = oldDirs_.find(rel);
+        return it == oldDirs_.end() ? NO_PARENT : it->second;
+    }
+
+    void listDir(Builder& b, const std::filesystem::path& full, uint32_t self, uint32_t old,
+                 std::vector<std::string>& subdirs) {
+        std::unordered_map<std::string_view, const FileRecord*> previous;
+        if (old != NO_PARENT) {
+            const DirRecord& o = dirs()[old];
+            for (uint32_t i = 0; i < o.fileCount; ++i) {
+                previous.emplace(name(files()[o.firstFile + i]), &files()[o.firstFile + i]);
+            }
+        }
+        std::string rel(b.dirPath(self));
+
+        DIR* dir = ::opendir(full.c_str());
+        if (!dir) return;
+        int fd = ::dirfd(dir);
+        while (struct dirent* e = ::readdir(dir)) {
+            const char* n = e->d_name;
+            if (n[0] == '.' && (n[1] == '\0' || (n[1] == '.' && n[2] == '\0'))) continue;
+            struct stat st;
+            if (::fstatat(fd, n, &st, 0) != 0) continue;
+            if (S_ISDIR(st.st_mode)) {
+                if (e->d_type != DT_LNK) subdirs.push_back(rel.empty() ? n : rel + "/" + n);
+                continue;
+            }
+            if (!S_ISREG(st.st_mode)) continue;
+
+            FileRecord f{};
+            f.size = static_cast<uint64_t>(st.st_size);
+            f.mtimeNs = mtimeNs(st);
+            auto it = previous.find(n);
+            if (it != previous.end() && it->second->size == f.size && it->second->mtimeNs == f.mtimeNs) {
+                f.edge = it->second->edge;
+                f.full = it->second->full;
+            } else {
+                b.toHash.push_back(b.files.size());
+            }
+            size_t len = std::strlen(n);
+            f.nameHash = hash128(n, len).lo;
+            f.dir = self;
+            f.nameOff = b.addString(std::string_view(n, len));
+            f.nameLen = static_cast<uint32_t>(len);
+            b.files.push_back(f);
+        }
+        ::closedir(dir);
+    }
+
+    bool write(const Builder& b, const std::filesystem::path& file, std::string& error) {
+        // Unreadable files are dropped rather than indexed with bogus hashes
+        std::vector<FileRecord> files;
+        std::vector<DirRecord> dirs = b.dirs;
+        for (DirRecord& d : dirs) {
+            uint32_t first = static_cast<uint32_t>(files.size());
+            for (uint32_t i = 0; i < d.fileCount; ++i) {
+                const FileRecord& f = b.files[d.firstFile + i];
+                if (f.size != UINT64_MAX) files.push_back(f);
+            }
+            d.firstFile = first;
+            d.fileCount = static_cast<uint32_t>(files.size()) - first;
+        }
+
+        uint64_t slotCount = 16;
+        while (slotCount < files.size() * 2) slotCount *= 2;
+        std::vector<uint32_t> slots(TABLE_COUNT * slotCount, 0);
+        auto insert = [&](Table t, uint64_t key, uint32_t idx, auto same) {
+            uint32_t* table = slots.data() + t * slotCount;
+            for (uint64_t i = key & (slotCount - 1);; i = (i + 1) & (slotCount - 1)) {
+                if (table[i] == 0) {
+                    table[i] = idx + 1;
+                    return;
+                }
+                if (same(files[table[i] - 1])) return;  // keep the first file per key
+            }
+        };
+        for (uint32_t i = 0; i < files.size(); ++i) {
+            const FileRecord& f = files[i];
+            std::string_view n(b.strings.data() + f.nameOff, f.nameLen);
+            insert(TABLE_NAME, f.nameHash, i, [&](const FileRecord& o) {
+                return o.nameHash == f.nameHash && std::string_view(b.strings.data() + o.nameOff, o.nameLen) == n;
+            });
+            insert(TABLE_SIZE, f.size, i, [&](const FileRecord& o) { return o.size == f.size; });
+            insert(TABLE_EDGE, mix(f.size, f.edge), i,
+                   [&](const FileRecord& o) { return o.size == f.size && o.edge == f.edge; });
+            insert(TABLE_FULL, mix(f.size, f.full), i,
+                   [&](const FileRecord& o) { return o.size == f.size && o.full == f.full; });
+        }
+
+        Header h{};
+        std::memcpy(h.magic, MAGIC, sizeof(MAGIC));
+        h.dirCount = dirs.size();
+        h.fileCount = files.size();
+        h.slotCount = slotCount;
+        h.stringsSize = b.strings.size();
+
+        std::filesystem::path tmp = file;
+        tmp += ".tmp";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            error = "cannot create " + tmp.string() + ": " + std::strerror(errno);
+            return false;
+        }
+        auto put = [&](const void* data, size_t len) {
+            const char* p = static_cast<const char*>(data);
+            while (len > 0) {
+                ssize_t n = ::write(fd, p, len);
+                if (n <= 0) return false;
+                p += n;
+                len -= static_cast<size_t>(n);
+            }
+            return true;
+        };
+        bool ok = put(&h, sizeof(h)) && put(dirs.data(), dirs.size() * sizeof(DirRecord)) &&
+                  put(files.data(), files.size() * sizeof(FileRecord)) &&
+                  put(slots.data(), slots.size() * sizeof(uint32_t)) && put(b.strings.data(), b.strings.size());
+        ok = ::close(fd) == 0 && ok;
+        if (!ok || ::rename(tmp.c_str(), file.c_str()) != 0) {
+            error = "cannot write " + file.string() + ": " + std::strerror(errno);
+            ::unlink(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool map(const std::filesystem::path& file) {
+        int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(Header)) {
+            void* p = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+            if (p != MAP_FAILED) {
+                base_ = p;
+                size_ = static_cast<size_t>(st.st_size);
+            }
+        }
+        ::close(fd);
+        const Header* h = header();
+        if (valid() && (std::memcmp(h->magic, MAGIC, sizeof(MAGIC)) != 0 ||
+                        (h->slotCount & (h->slotCount - 1)) != 0 ||
+                        fileSize(h->dirCount, h->fileCount, h->slotCount, h->stringsSize) != size_)) {
+            unmap();
+        }
+        return valid();
+    }
+
+    void unmap() {
+        if (base_) ::munmap(base_, size_);
+        base_ = nullptr;
+        size_ = 0;
+        oldDirs_.clear();
+        oldChildren_.clear();
+    }
+
+    std::filesystem::path root_;
+    void* base_ = nullptr;
+    size_t size_ = 0;
+    RefreshStats stats_;
+    std::unordered_map<std::string_view, uint32_t> oldDirs_;
+    std::vector<std::vector<uint32_t>> oldChildren_;
+};
@@ -0,0 +1,340 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <regex>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include "game_header.hpp"
+#include "rules.hpp"
+
+// Who played a routed game, which side the rule's player had and how it
+// ended, plus the per-output-root manifest organize_kif appends these to.
+// Participants come from the header (先手/後手, 下手/上手, White/Black),
+// falling back to the rule's "players_pattern" on the file name. The
+// result comes from 勝者 or the closing "まで…" line for KIF and from the
+// Result tag for PGN.
+//
+// The manifest of an output root lives next to it, as .<folder>.kifmanifest
+// (like compare_kif's index), so tools walking the root never see it. It is
+// "KIFMAN01" followed by rows of a 32-byte
+// header {uint32 length, uint32 date (yyyymmdd, 0 if unknown), uint64
+// size, uint8 format, side, result, reserved, uint16 player, opponent and
+// path lengths, 6 bytes reserved} and the three strings. Paths are
+// relative to the output root. A torn last row is ignored by the reader
+// and cut off by the next append.
+
+enum class GameFormat : uint8_t { Kif = 0, Pgn = 1 };
+enum class Side : uint8_t { Unknown = 0, First = 1, Second = 2 };  // sente/white, gote/black
+enum class Outcome : uint8_t { Unknown = 0, Win = 1, Loss = 2, Draw = 3 };
+
+inline const char* sideName(GameFormat format, Side side) {
+    if (side == Side::Unknown) return "unknown";
+    if (format == GameFormat::Pgn) return side == Side::First ? "white" : "black";
+    return side == Side::First ? "sente" : "gote";
+}
+
+inline const char* outcomeName(Outcome outcome) {
+    switch (outcome) {
+        case Outcome::Win: return "win";
+        case Outcome::Loss: return "loss";
+        case Outcome::Draw: return "draw";
+        default: return "unknown";
+    }
+}
+
+struct GameSummary {
+    GameFormat format = GameFormat::Kif;
+    std::string first;   // sente / white
+    std::string second;  // gote / black
+    Side side = Side::Unknown;        // the rule's player
+    Outcome result = Outcome::Unknown;  // from the player's point of view
+    uint32_t date = 0;                  // yyyymmdd
+    const std::string& opponent() const { return side == Side::Second ? first : second; }
+};
+
+struct ManifestRow {
+    GameSummary game;
+    std::string player;
+    std::string path;
+    uint64_t size = 0;
+};
+
+namespace manifest {
+
+constexpr size_t ROW_HEADER = 32;
+
+// Account name without rating or rank: "Squika(1722)" and
+// "Love_Kapibara 三段" become "Squika" and "Love_Kapibara"
+inline std::string playerName(std::string_view value) {
+    static const std::string_view IDEOGRAPHIC_SPACE = "\xE3\x80\x80";
+    size_t cut = std::min({value.find('('), value.find(' '), value.find(IDEOGRAPHIC_SPACE)});
+    return std::string(value.substr(0, cut));
+}
+
+// yyyymmdd from the first three numbers of a date string, 0 if none
+inline uint32_t parseDate(std::string_view value) {
+    uint32_t parts[3] = {0, 0, 0};
+    size_t count = 0;
+    for (size_t i = 0; i < value.size() && count < 3;) {
+        if (value[i] < '0' || value[i] > '9') {
+            ++i;
+            continue;
+        }
+        uint32_t n = 0;
+        size_t digits = 0;
+        for (; i < value.size() && value[i] >= '0' && value[i] <= '9'; ++i, ++digits) n = n * 10 + (value[i] - '0');
+        if (count == 0 && digits == 8) return n;  // already yyyymmdd
+        parts[count++] = n;
+    }
+    if (count < 3 || parts[0] < 1000 || parts[1] > 12 || parts[2] > 31) return 0;
+    return parts[0] * 10000 + parts[1] * 100 + parts[2];
+}
+
+// Winner named by a KIF closing line such as "まで84手で後手の勝ち" or
+// "まで55手で詰み" (the side that made the last move wins)
+inline Side kifWinner(const std::string& line, bool& draw) {
+    draw = false;
+    if (line.find("\xE5\x85\x88\xE6\x89\x8B\xE3\x81\xAE\xE5\x8B\x9D") != std::string::npos ||   // 先手の勝
+        line.find("\xE4\xB8\x8B\xE6\x89\x8B\xE3\x81\xAE\xE5\x8B\x9D") != std::string::npos) {   // 下手の勝
+        return Side::First;
+    }
+    if (line.find("\xE5\xBE\x8C\xE6\x89\x8B\xE3\x81\xAE\xE5\x8B\x9D") != std::string::npos ||   // 後手の勝
+        line.find("\xE4\xB8\x8A\xE6\x89\x8B\xE3\x81\xAE\xE5\x8B\x9D") != std::string::npos) {   // 上手の勝
+        return Side::Second;
+    }
+    if (line.find("\xE5\x8D\x83\xE6\x97\xA5\xE6\x89\x8B") != std::string::npos ||    // 千日手
+        line.find("\xE6\x8C\x81\xE5\xB0\x86\xE6\xA3\x8B") != std::string::npos) {    // 持将棋
+        draw = true;
+        return Side::Unknown;
+    }
+    if (line.find("\xE8\xA9\xB0\xE3\x81\xBF") != std::string::npos) {               // 詰み
+        unsigned plies = 0;
+        for (char c : line) {
+            if (c >= '0' && c <= '9') plies = plies * 10 + (c - '0');
+        }
+        return plies % 2 == 1 ? Side::First : Side::Second;
+    }
+    return Side::Unknown;
+}
+
+inline void put16(std::string& out, size_t at, size_t v) {
+    uint16_t x = static_cast<uint16_t>(v);
+    std::memcpy(&out[at], &x, 2);
+}
+
+inline void encodeRow(const ManifestRow& row, std::string& out) {
+    size_t at = out.size();
+    size_t length = ROW_HEADER + row.player.size() + row.game.opponent().size() + row.path.size();
+    out.resize(at + ROW_HEADER, '\0');
+    uint32_t len32 = static_cast<uint32_t>(length);
+    std::memcpy(&out[at], &len32, 4);
+    std::memcpy(&out[at + 4], &row.game.date, 4);
+    std::memcpy(&out[at + 8], &row.size, 8);
+    out[at + 16] = static_cast<char>(row.game.format);
+    out[at + 17] = static_cast<char>(row.game.side);
+    out[at + 18] = static_cast<char>(row.game.result);
+    put16(out, at + 20, row.player.size());
+    put16(out, at + 22, row.game.opponent().size());
+    put16(out, at + 24, row.path.size());
+    out += row.player;
+    out += row.game.opponent();
+    out += row.path;
+}
+
+// Read the rest of `fd` into `data`
+inline void readAll(int fd, std::string& data) {
+    char buf[1 << 16];
+    ssize_t n;
+    while ((n = ::read(fd, buf, sizeof(buf))) > 0) data.append(buf, static_cast<size_t>(n));
+}
+
+// Length of the complete row at `pos` of manifest `data`, 0 if it is torn
+inline size_t rowLength(const std::string& data, size_t pos) {
+    if (pos + ROW_HEADER > data.size()) return 0;
+    const char* p = data.data() + pos;
+    uint32_t length;
+    uint16_t playerLen, opponentLen, pathLen;
+    std::memcpy(&length, p, 4);
+    std::memcpy(&playerLen, p + 20, 2);
+    std::memcpy(&opponentLen, p + 22, 2);
+    std::memcpy(&pathLen, p + 24, 2);
+    if (length > data.size() - pos || length != ROW_HEADER + playerLen + opponentLen + pathLen) return 0;
+    return length;
+}
+
+}  // namespace manifest
+
+// Summarize `name` for `rule`; `header` may be nullptr, and conclusion()
+// returns the KIF "まで…" line, called only when the header has no winner
+template <typename Conclusion>
+GameSummary summarizeGame(const Rule& rule, const std::string& name, const GameHeader* header,
+                          Conclusion&& conclusion, const std::string& plannedDate) {
+    GameSummary game;
+    bool pgn = name.size() >= 4 && name.compare(name.size() - 4, 4, ".pgn") == 0;
+    game.format = pgn ? GameFormat::Pgn : GameFormat::Kif;
+
+    auto field = [&](const char* key) -> const std::string* { return header ? header->find(key) : nullptr; };
+    const std::string* first = pgn ? field("White") : field("\xE5\x85\x88\xE6\x89\x8B");     // 先手
+    const std::string* second = pgn ? field("Black") : field("\xE5\xBE\x8C\xE6\x89\x8B");    // 後手
+    if (!pgn && !first) first = field("\xE4\xB8\x8B\xE6\x89\x8B");                          // 下手
+    if (!pgn && !second) second = field("\xE4\xB8\x8A\xE6\x89\x8B");                        // 上手
+    if (first && second) {
+        game.first = manifest::playerName(*first);
+        game.second = manifest::playerName(*second);
+    } else if (rule.hasPlayersPattern) {
+        std::smatch m;
+        if (std::regex_search(name, m, rule.playersRegex) && m.size() > 2) {
+            game.first = manifest::playerName(m[1].str());
+            game.second = manifest::playerName(m[2].str());
+        }
+    }
+    if (!rule.player.empty()) {
+        if (game.first == rule.player) game.side = Side::First;
+        else if (game.second == rule.player) game.side = Side::Second;
+    }
+
+    Side winner = Side::Unknown;
+    bool draw = false;
+    if (pgn) {
+        if (const std::string* result = field("Result")) {
+            if (*result == "1-0") winner = Side::First;
+            else if (*result == "0-1") winner = Side::Second;
+            else draw = *result == "1/2-1/2";
+        }
+    } else if (const std::string* won = field("\xE5\x8B\x9D\xE8\x80\x85")) {               // 勝者
+        if (won->find("\xE2\x96\xB2") != std::string::npos || won->find("\xE2\x98\x97") != std::string::npos) {
+            winner = Side::First;   // ▲ ☗
+        } else if (won->find("\xE2\x96\xB3") != std::string::npos || won->find("\xE2\x98\x96") != std::string::npos) {
+            winner = Side::Second;  // △ ☖
+        }
+    } else {
+        winner = manifest::kifWinner(conclusion(), draw);
+    }
+    if (draw) {
+        game.result = Outcome::Draw;
+    } else if (winner != Side::Unknown && game.side != Side::Unknown) {
+        game.result = winner == game.side ? Outcome::Win : Outcome::Loss;
+    }
+
+    const std::string* date = pgn ? field("Date") : field("\xE9\x96\x8B\xE5\xA7\x8B\xE6\x97\xA5\xE6\x99\x82");  // 開始日時
+    game.date = date ? manifest::parseDate(*date) : 0;
+    if (game.date == 0) game.date = manifest::parseDate(plannedDate);
+    return game;
+}
+
+// Location of the manifest for an output root
+inline std::filesystem::path manifestPath(const std::filesystem::path& root) {
+    std::filesystem::path abs = std::filesystem::absolute(root).lexically_normal();
+    if (!abs.has_filename()) abs = abs.parent_path();
+    return abs.parent_path() / ("." + abs.filename().string() + ".kifmanifest");
+}
+
+// Append rows to the manifest of `root` in one write, creating it if needed.
+// A torn last row left by an interrupted append is cut off first, so the
+// new rows stay readable.
+inline bool appendManifest(const std::filesystem::path& root, const std::vector<ManifestRow>& rows,
+                           std::string& error) {
+    if (rows.empty()) return true;
+    std::filesystem::path path = manifestPath(root);
+    std::string out;
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644);
+    if (fd >= 0) {
+        out = "KIFMAN01";
+    } else if (errno == EEXIST) {
+        fd = ::open(path.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+    }
+    if (fd < 0) {
+        error = "Could not open " + path.string() + ": " + std::strerror(errno);
+        return false;
+    }
+    if (out.empty()) {
+        std::string data;
+        manifest::readAll(fd, data);
+        size_t valid = 0;
+        if (data.size() < 8 && std::string_view("KIFMAN01").substr(0, data.size()) == data) {
+            out = "KIFMAN01";  // torn while the manifest was created
+        } else if (data.compare(0, 8, "KIFMAN01") != 0) {
+            error = path.string() + " is not a manifest";
+            ::close(fd);
+            return false;
+        } else {
+            valid = 8;
+            while (size_t length = manifest::rowLength(data, valid)) valid += length;
+        }
+        if (valid != data.size() && ::ftruncate(fd, static_cast<off_t>(valid)) != 0) {
+            error = "Could not truncate " + path.string() + ": " + std::strerror(errno);
+            ::close(fd);
+            return false;
+        }
+    }
+    for (const ManifestRow& row : rows) manifest::encodeRow(row, out);
+    bool ok = ::write(fd, out.data(), out.size()) == static_cast<ssize_t>(out.size());
+    if (!ok) error = "Could not write " + path.string() + ": " + std::strerror(errno);
+    ::close(fd);
+    return ok;
+}
+
+// Read every complete row of the manifest of `root`. The opponent is stored
+// in row.game.second, or in row.game.first when the player was gote/black.
+inline bool readManifest(const std::filesystem::path& root, std::vector<ManifestRow>& rows, std::string& error) {
+    std::filesystem::path path = manifestPath(root);
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error = "Could not open " + path.string() + ": " + std::strerror(errno);
+        return false;
+    }
+    std::string data;
+    manifest::readAll(fd, data);
+    ::close(fd);
+    if (data.compare(0, 8, "KIFMAN01") != 0) {
+        error = path.string() + " is not a manifest";
+        return false;
+    }
+    for (size_t pos = 8, length; (length = manifest::rowLength(data, pos)) != 0;) {
+        const char* p = data.data() + pos;
+        uint16_t playerLen, opponentLen, pathLen;
+        std::memcpy(&playerLen, p + 20, 2);
+        std::memcpy(&opponentLen, p + 22, 2);
+        std::memcpy(&pathLen, p + 24, 2);
+        ManifestRow row;
+        std::memcpy(&row.game.date, p + 4, 4);
+        std::memcpy(&row.size, p + 8, 8);
+        row.game.format = static_cast<GameFormat>(p[16]);
+        row.game.side = static_cast<Side>(p[17]);
+        row.game.result = static_cast<Outcome>(p[18]);
+        const char* s = p + manifest::ROW_HEADER;
+        row.player.assign(s, playerLen);
+        std::string opponent(s + playerLen, opponentLen);
+        (row.game.side == Side::Second ? row.game.first : row.game.second) = std::move(opponent);
+        row.path.assign(s + playerLen + opponentLen, pathLen);
+        rows.push_back(std::move(row));
+        pos += length;
+    }
+    return true;
+}
+
+// Replace the manifest of `root` with `rows` (temporary file + rename)
+inline bool rewriteManifest(const std::filesystem::path& root, const std::vector<ManifestRow>& rows,
+                            std::string& error) {
+    std::filesystem::path path = manifestPath(root);
+    std::filesystem::path tmp = path.string() + ".tmp";
+    std::string out = "KIFMAN01";
+    for (const ManifestRow& row : rows) manifest::encodeRow(row, out);
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = fd >= 0 && ::write(fd, out.data(), out.size()) == static_cast<ssize_t>(out.size()) &&
+              ::fsync(fd) == 0;
+    if (fd >= 0) ::close(fd);
+    if (!ok || ::rename(tmp.c_str(), path.c_str()) != 0) {
+        error = "Could not rewrite " + path.string() + ": " + std::strerror(errno);
+        ::unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
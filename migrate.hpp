@@ -0,0 +1,222 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_set>
+#include <algorithm>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "walker.hpp"
+#include "parallel.hpp"
+#include "rules.hpp"
+#include "manifest.hpp"
+#include "move_plan.hpp"
+#include "journal.hpp"
+#include "position_index.hpp"
+
+// Moves an existing output tree to its rule's current "layout". Every file
+// under the root is matched again (name, then header) to find its date,
+// and files whose folder differs from the layout are renamed with
+// RENAME_NOREPLACE, one worker per target folder. Folders emptied by the
+// migration are removed and the root's manifest paths are rewritten; undoing
+// the migration's journal reverses both (revertMoves).
+
+struct Migration {
+    std::filesystem::path root;
+    std::vector<JournalEntry> moves;  // absolute paths, id = index
+    std::vector<std::string> unresolved;
+    std::vector<std::string> errors;  // directories that could not be read
+};
+
+// Match `name` in the open directory dirFd against the rules, reading its
+// header only if a rule needs it. True if a rule of `root` matches and the
+// game's folder below the root is known: `rule`, `game` and `layout` are
+// then set.
+inline bool resolveInRoot(const RuleMatcher& rules, const std::filesystem::path& root, int dirFd,
+                          const std::string& name, const Rule*& rule, GameSummary& game, std::string& layout) {
+    GameHeader header;
+    bool loaded = false, readable = false;
+    auto loadHeader = [&]() -> const GameHeader* {
+        if (!loaded) {
+            readable = readGameHeader(dirFd, name, header);
+            loaded = true;
+        }
+        return readable ? &header : nullptr;
+    };
+    auto match = rules.match(name, loadHeader);
+    if (!match || std::filesystem::path(match->rule->outputPath).lexically_normal() != root.lexically_normal()) {
+        return false;
+    }
+    rule = match->rule;
+    game = summarizeGame(*rule, name, loadHeader(), [&]() { return readKifConclusion(dirFd, name); }, match->date);
+    return RuleMatcher::layoutPath(*rule, match->date, game.date, name, layout);
+}
+
+// Work out where every game under `root` belongs
+inline Migration planMigration(const RuleMatcher& rules, const std::filesystem::path& root, unsigned threads) {
+    Migration migration;
+    migration.root = root;
+    std::filesystem::path absRoot = std::filesystem::absolute(root).lexically_normal();
+    std::vector<std::filesystem::path> files = listFiles(root, {threads, -1}, migration.errors);
+    std::vector<JournalEntry> planned(files.size());
+    std::vector<char> resolved(files.size(), 0);
+
+    parallelFor(files.size(), threads, [&](size_t i) {
+        std::string name = files[i].filename().string();
+        if (name.empty() || name[0] == '.') {
+            resolved[i] = 1;  // temporary and bookkeeping files stay put
+            return;
+        }
+        std::filesystem::path parent = files[i].parent_path();
+        int dirFd = ::open(parent.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirFd < 0) return;
+        const Rule* rule = nullptr;
+        GameSummary game;
+        std::string layout;
+        resolved[i] = resolveInRoot(rules, root, dirFd, name, rule, game, layout);
+        struct stat st {};
+        ::fstatat(dirFd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW);
+        ::close(dirFd);
+        if (!resolved[i]) return;
+
+        std::filesystem::path source = std::filesystem::absolute(files[i]).lexically_normal();
+        std::filesystem::path target = (absRoot / layout / name).lexically_normal();
+        if (source == target) return;
+        planned[i].inode = st.st_ino;
+        planned[i].size = static_cast<uint64_t>(st.st_size);
+        planned[i].source = source.string();
+        planned[i].target = target.string();
+    });
+
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (!resolved[i]) {
+            migration.unresolved.push_back(files[i].string());
+        } else if (!planned[i].source.empty()) {
+            planned[i].id = migration.moves.size();
+            migration.moves.push_back(std::move(planned[i]));
+        }
+    }
+    return migration;
+}
+
+// Remove `dir` and its parents below `root` while they are empty
+inline void removeEmptyParents(std::filesystem::path dir, const std::filesystem::path& root) {
+    while (dir != root && dir.string().size() > root.string().size()) {
+        if (::rmdir(dir.c_str()) != 0) return;
+        dir = dir.parent_path();
+    }
+}
+
+// Rename manifest rows and position index paths of `root` (old → new,
+// relative to the root)
+inline void renameRecorded(const std::filesystem::path& root, const std::map<std::string, std::string>& renamed,
+                           MoveReport& report) {
+    if (renamed.empty()) return;
+    std::vector<ManifestRow> rows;
+    std::string error;
+    if (std::filesystem::exists(manifestPath(root)) && readManifest(root, rows, error)) {
+        for (auto& row : rows) {
+            auto it = renamed.find(row.path);
+            if (it != renamed.end()) row.path = it->second;
+        }
+        if (!rewriteManifest(root, rows, error)) report.errors.push_back(error);
+    }
+    if (std::filesystem::exists(PositionIndex::pathFor(root)) && !PositionIndex::renamePaths(root, renamed, error)) {
+        report.errors.push_back(error);
+    }
+}
+
+inline MoveReport executeMigration(const Migration& migration, unsigned jobs, Journal& journal) {
+    MoveReport report;
+    std::map<std::string, std::vector<size_t>> byTarget;
+    for (size_t i = 0; i < migration.moves.size(); ++i) {
+        byTarget[std::filesystem::path(migration.moves[i].target).parent_path().string()].push_back(i);
+    }
+    std::vector<std::vector<size_t>> groups;
+    for (auto& [dir, list] : byTarget) groups.push_back(std::move(list));
+
+    std::vector<char> moved(migration.moves.size(), 0);
+    std::vector<std::string> errors(migration.moves.size());
+    parallelFor(groups.size(), jobs, [&](size_t g) {
+        std::error_code ec;
+        std::filesystem::create_directories(std::filesystem::path(migration.moves[groups[g][0]].target).parent_path(), ec);
+        for (size_t i : groups[g]) {
+            const JournalEntry& move = migration.moves[i];
+            if (moveFile(move.source, move.target, errors[i])) {
+                moved[i] = 1;
+                journal.done(move.id);
+            }
+        }
+    });
+
+    std::filesystem::path absRoot = std::filesystem::absolute(migration.root).lexically_normal();
+    std::map<std::string, std::string> renamed;  // old → new path relative to the root
+    std::vector<std::filesystem::path> emptied;
+    for (size_t i = 0; i < migration.moves.size(); ++i) {
+        if (!errors[i].empty()) report.errors.push_back(errors[i]);
+        if (!moved[i]) continue;
+        ++report.moved;
+        std::filesystem::path source(migration.moves[i].source);
+        renamed[source.lexically_relative(absRoot).string()] =
+            std::filesystem::path(migration.moves[i].target).lexically_relative(absRoot).string();
+        emptied.push_back(source.parent_path());
+    }
+    std::sort(emptied.begin(), emptied.end());
+    emptied.erase(std::unique(emptied.begin(), emptied.end()), emptied.end());
+    for (const auto& dir : emptied) removeEmptyParents(dir, absRoot);
+
+    renameRecorded(migration.root, renamed, report);
+    return report;
+}
+
+// Path of `path` relative to `absRoot`, false if it lies outside the root
+inline bool relativeTo(const std::filesystem::path& path, const std::filesystem::path& absRoot, std::string& rel) {
+    std::filesystem::path r = std::filesystem::path(path).lexically_normal().lexically_relative(absRoot);
+    if (r.empty() || *r.begin() == "..") return false;
+    rel = r.string();
+    return true;
+}
+
+// Update the bookkeeping of `root` for moves that were undone (`restored`
+// from undoJournal). A migration's games get their old paths back in the
+// manifest and position index; games a routing batch brought in from
+// outside the root lose their manifest rows and postings, so routing them
+// again does not record them twice. Folders emptied by the undo are
+// removed. Entries whose target is outside `root` are ignored.
+inline void revertMoves(const std::filesystem::path& root, const std::vector<JournalEntry>& restored,
+                        MoveReport& report) {
+    std::filesystem::path absRoot = std::filesystem::absolute(root).lexically_normal();
+    std::map<std::string, std::string> renamed;  // migrated → original path relative to the root
+    std::unordered_set<std::string> removed;     // routed in, relative to the root
+    std::vector<std::filesystem::path> emptied;
+    for (const JournalEntry& entry : restored) {
+        std::string from, to;
+        if (!relativeTo(entry.target, absRoot, from)) continue;
+        if (relativeTo(entry.source, absRoot, to)) {
+            renamed[from] = to;
+        } else {
+            removed.insert(from);
+        }
+        emptied.push_back(std::filesystem::path(entry.target).parent_path());
+    }
+    std::sort(emptied.begin(), emptied.end());
+    emptied.erase(std::unique(emptied.begin(), emptied.end()), emptied.end());
+    for (const auto& dir : emptied) removeEmptyParents(dir, absRoot);
+    renameRecorded(root, renamed, report);
+    if (removed.empty()) return;
+
+    std::vector<ManifestRow> rows;
+    std::string error;
+    if (std::filesystem::exists(manifestPath(root)) && readManifest(root, rows, error)) {
+        size_t before = rows.size();
+        auto gone = [&](const ManifestRow& row) { return removed.count(row.path) > 0; };
+        rows.erase(std::remove_if(rows.begin(), rows.end(), gone), rows.end());
+        if (rows.size() != before && !rewriteManifest(root, rows, error)) report.errors.push_back(error);
+    }
+    if (std::filesystem::exists(PositionIndex::pathFor(root)) && !PositionIndex::removePaths(root, removed, error)) {
+        report.errors.push_back(error);
+    }
+}
@@ -0,0 +1,306 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <filesystem>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include "json.hpp"
+#include "parallel.hpp"
+#include "rules.hpp"
+#include "manifest.hpp"
+
+// Two-phase routing for organize_kif. buildPlan resolves every input file
+// to a target directory without touching the filesystem, deduplicating the
+// directories. executePlan then creates each directory once, opens it once,
+// and moves files with renameat2(RENAME_NOREPLACE) relative to the cached
+// descriptors, one worker per target directory. Files whose target is on
+// another filesystem (EXDEV) are copied in the kernel by a second pass.
+
+struct PlannedMove {
+    std::string name;   // file name, identical in source and target
+    uint32_t dir;       // index into MovePlan::dirs
+    const Rule* rule;
+    GameSummary game;
+};
+
+struct MovePlan {
+    std::filesystem::path source;
+    std::vector<std::filesystem::path> dirs;
+    std::vector<PlannedMove> moves;
+    std::vector<std::string> unmatched;
+
+    nlohmann::json toJson() const {
+        nlohmann::json plan;
+        plan["source"] = source.string();
+        plan["directories"] = nlohmann::json::array();
+        for (const auto& dir : dirs) plan["directories"].push_back(dir.string());
+        plan["moves"] = nlohmann::json::array();
+        for (const auto& move : moves) {
+            plan["moves"].push_back({{"file", move.name},
+                                     {"target", (dirs[move.dir] / move.name).string()},
+                                     {"rule", move.rule->name},
+                                     {"players", {move.game.first, move.game.second}},
+                                     {"side", sideName(move.game.format, move.game.side)},
+                                     {"result", outcomeName(move.game.result)}});
+        }
+        plan["unmatched"] = unmatched;
+        return plan;
+    }
+};
+
+struct MoveReport {
+    size_t moved = 0;
+    std::vector<std::string> errors;
+};
+
+// Per-move flags handed to the manifest bookkeeping: the file was moved by
+// this run, or it was found in place, left by an earlier run that may have
+// died before recording it
+constexpr char MOVED = 1;
+constexpr char FOUND_IN_PLACE = 2;
+
+// Resolve every name to its target directory and summarize the game for
+// the manifest. Only the header (and, for KIF without 勝者, the last 2 KiB)
+// of each routed file is read, through one descriptor of the source folder.
+inline MovePlan buildPlan(const std::filesystem::path& source, const std::vector<std::string>& names,
+                          const RuleMatcher& rules) {
+    MovePlan plan;
+    plan.source = source;
+    int srcFd = ::open(source.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    std::unordered_map<std::string, uint32_t> dirIndex;
+    for (const std::string& name : names) {
+        GameHeader header;
+        bool loaded = false, readable = false;
+        auto loadHeader = [&]() -> const GameHeader* {
+            if (!loaded) {
+                readable = srcFd >= 0 && readGameHeader(srcFd, name, header);
+                loaded = true;
+            }
+            return readable ? &header : nullptr;
+        };
+        auto match = rules.match(name, loadHeader);
+        if (!match) {
+            plan.unmatched.push_back(name);
+            continue;
+        }
+        GameSummary game = summarizeGame(*match->rule, name, loadHeader(),
+                                         [&]() { return readKifConclusion(srcFd, name); }, match->date);
+        std::string layout;
+        if (!RuleMatcher::layoutPath(*match->rule, match->date, game.date, name, layout)) {
+            plan.unmatched.push_back(name);
+            continue;
+        }
+        std::filesystem::path dir = std::filesystem::path(match->rule->outputPath) / layout;
+        auto [it, inserted] = dirIndex.emplace(dir.string(), static_cast<uint32_t>(plan.dirs.size()));
+        if (inserted) plan.dirs.push_back(dir);
+        plan.moves.push_back({name, it->second, match->rule, std::move(game)});
+    }
+    if (srcFd >= 0) ::close(srcFd);
+    return plan;
+}
+
+// Copy `name` from srcFd to a temporary file in dstFd with copy_file_range
+// (sendfile where that is unsupported), keeping mode and timestamps, fsync
+// it and rename it into place without replacing an existing file. The
+// source is left alone; it is unlinked once the target directory is synced.
+inline bool copyAcrossDevices(int srcFd, int dstFd, const std::string& name,
+                              const std::filesystem::path& target, std::string& error) {
+    int in = ::openat(srcFd, name.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (in < 0 || ::fstat(in, &st) != 0) {
+        error = "Could not open " + name + ": " + std::strerror(errno);
+        if (in >= 0) ::close(in);
+        return false;
+    }
+    std::string tmp = "." + name + ".kifmove-" + std::to_string(::getpid());
+    int out = ::openat(dstFd, tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777);
+    if (out < 0) {
+        error = "Could not create " + target.string() + ": " + std::strerror(errno);
+        ::close(in);
+        return false;
+    }
+
+    bool useSendfile = false;
+    off_t remaining = st.st_size;
+    int err = 0;
+    while (remaining > 0) {
+        ssize_t n = useSendfile ? ::sendfile(out, in, nullptr, remaining)
+                                : ::copy_file_range(in, nullptr, out, nullptr, remaining, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && !useSendfile && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) {
+            useSendfile = true;
+            continue;
+        }
+        if (n <= 0) {
+            err = n < 0 ? errno : EIO;  // a short source means it changed under us
+            break;
+        }
+        remaining -= n;
+    }
+    if (err == 0) {
+        struct timespec times[2] = {st.st_atim, st.st_mtim};
+        ::fchmod(out, st.st_mode & 07777);
+        if (::futimens(out, times) != 0 || ::fsync(out) != 0) err = errno;
+    }
+    if (::close(out) != 0 && err == 0) err = errno;
+    ::close(in);
+    if (err == 0 && ::renameat2(dstFd, tmp.c_str(), dstFd, name.c_str(), RENAME_NOREPLACE) != 0) err = errno;
+    if (err != 0) {
+        ::unlinkat(dstFd, tmp.c_str(), 0);
+        error = err == EEXIST ? "Target already exists, skipping: " + target.string()
+                              : "Could not copy " + name + ": " + std::strerror(err);
+        return false;
+    }
+    return true;
+}
+
+// Move a single file between two paths with the same file name, with the
+// same no-replace and cross-device semantics as executePlan
+inline bool moveFile(const std::filesystem::path& from, const std::filesystem::path& to, std::string& error) {
+    if (::renameat2(AT_FDCWD, from.c_str(), AT_FDCWD, to.c_str(), RENAME_NOREPLACE) == 0) return true;
+    if (errno == EEXIST) {
+        error = "Target already exists, skipping: " + to.string();
+        return false;
+    }
+    if (errno != EXDEV) {
+        error = "Could not move " + from.string() + ": " + std::strerror(errno);
+        return false;
+    }
+    std::filesystem::path fromDir = from.parent_path().empty() ? "." : from.parent_path();
+    std::filesystem::path toDir = to.parent_path().empty() ? "." : to.parent_path();
+    int fromFd = ::open(fromDir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    int toFd = ::open(toDir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    std::string name = from.filename().string();
+    bool ok = fromFd >= 0 && toFd >= 0;
+    if (!ok) {
+        error = "Could not open " + (fromFd < 0 ? fromDir : toDir).string() + ": " + std::strerror(errno);
+    } else if ((ok = copyAcrossDevices(fromFd, toFd, name, to, error))) {
+        if (::fsync(toFd) != 0 || ::unlinkat(fromFd, name.c_str(), 0) != 0) {
+            error = "Copied " + name + " but could not remove source: " + std::strerror(errno);
+            ok = false;
+        }
+    }
+    if (fromFd >= 0) ::close(fromFd);
+    if (toFd >= 0) ::close(toFd);
+    return ok;
+}
+
+// Directories the cross-device pass of executePlan keeps open at a time: a
+// quarter of the open file limit, leaving room for the copies' own files
+inline size_t copyDirsOpen() {
+    struct rlimit limit;
+    if (::getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY) return 256;
+    return std::clamp<size_t>(static_cast<size_t>(limit.rlim_cur) / 4, 1, 256);
+}
+
+// Execute a plan. Same-filesystem moves are plain renames; cross-device
+// moves are collected and copied afterwards on at least four workers, since
+// they wait on device latency rather than CPU. Each target directory that
+// received copies is fsynced once before the copied sources are unlinked.
+// A directory's descriptor is closed after its renames, and the copy pass
+// reopens directories a few at a time (copyDirsOpen), so a batch spread
+// over many directories stays within the open file limit.
+// onMoved(i) is called, possibly concurrently, for every completed plan.moves[i].
+inline MoveReport executePlan(const MovePlan& plan, unsigned jobs,
+                              const std::function<void(size_t)>& onMoved = {}) {
+    MoveReport report;
+    int srcFd = ::open(plan.source.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (srcFd < 0) {
+        report.errors.push_back("Could not open " + plan.source.string() + ": " + std::strerror(errno));
+        return report;
+    }
+
+    std::vector<std::vector<size_t>> byDir(plan.dirs.size());
+    for (size_t i = 0; i < plan.moves.size(); ++i) byDir[plan.moves[i].dir].push_back(i);
+
+    std::vector<MoveReport> perDir(plan.dirs.size());
+    std::vector<std::vector<size_t>> crossDevice(plan.dirs.size());
+    parallelFor(plan.dirs.size(), jobs, [&](size_t d) {
+        MoveReport& out = perDir[d];
+        std::error_code ec;
+        std::filesystem::create_directories(plan.dirs[d], ec);
+        int dstFd = ::open(plan.dirs[d].c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dstFd < 0) {
+            out.errors.push_back("Could not create " + plan.dirs[d].string() + ": " +
+                                 (ec ? ec.message() : std::strerror(errno)));
+            return;
+        }
+        for (size_t i : byDir[d]) {
+            const std::string& name = plan.moves[i].name;
+            if (::renameat2(srcFd, name.c_str(), dstFd, name.c_str(), RENAME_NOREPLACE) == 0) {
+                ++out.moved;
+                if (onMoved) onMoved(i);
+            } else if (errno == EXDEV) {
+                crossDevice[d].push_back(i);
+            } else if (errno == EEXIST) {
+                out.errors.push_back("Target already exists, skipping: " + (plan.dirs[d] / name).string());
+            } else {
+                out.errors.push_back("Could not move " + name + ": " + std::strerror(errno));
+            }
+        }
+        ::close(dstFd);
+    });
+
+    std::vector<size_t> copyDirs;
+    for (size_t d = 0; d < plan.dirs.size(); ++d) {
+        if (!crossDevice[d].empty()) copyDirs.push_back(d);
+    }
+    std::vector<int> dstFds(plan.dirs.size(), -1);
+    std::vector<char> copied(plan.moves.size(), 0);
+    std::vector<std::string> copyErrors(plan.moves.size());
+    const size_t openDirs = copyDirsOpen();
+    for (size_t first = 0; first < copyDirs.size(); first += openDirs) {
+        size_t last = std::min(copyDirs.size(), first + openDirs);
+        std::vector<size_t> copies;
+        for (size_t c = first; c < last; ++c) {
+            size_t d = copyDirs[c];
+            dstFds[d] = ::open(plan.dirs[d].c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (dstFds[d] < 0) {
+                perDir[d].errors.push_back("Could not open " + plan.dirs[d].string() + ": " + std::strerror(errno));
+                continue;
+            }
+            copies.insert(copies.end(), crossDevice[d].begin(), crossDevice[d].end());
+        }
+        parallelFor(copies.size(), std::max(jobs, 4u), [&](size_t k) {
+            const PlannedMove& move = plan.moves[copies[k]];
+            copied[copies[k]] = copyAcrossDevices(srcFd, dstFds[move.dir], move.name,
+                                                 plan.dirs[move.dir] / move.name, copyErrors[copies[k]]);
+        });
+        for (size_t c = first; c < last; ++c) {
+            size_t d = copyDirs[c];
+            if (dstFds[d] < 0) continue;
+            bool synced = ::fsync(dstFds[d]) == 0;
+            ::close(dstFds[d]);
+            for (size_t i : crossDevice[d]) {
+                const std::string& name = plan.moves[i].name;
+                if (!copied[i]) {
+                    perDir[d].errors.push_back(copyErrors[i]);
+                } else if (!synced) {
+                    perDir[d].errors.push_back("Could not sync " + plan.dirs[d].string() + ", kept source " + name);
+                } else if (::unlinkat(srcFd, name.c_str(), 0) != 0) {
+                    perDir[d].errors.push_back("Copied " + name + " but could not remove source: " + std::strerror(errno));
+                } else {
+                    ++perDir[d].moved;
+                    if (onMoved) onMoved(i);
+                }
+            }
+        }
+    }
+    ::close(srcFd);
+
+    for (auto& part : perDir) {
+        report.moved += part.moved;
+        report.errors.insert(report.errors.end(), part.errors.begin(), part.errors.end());
+    }
+    return report;
+}
@@ -1,15 +1,38 @@
 #include <iostream>
 #include <fstream>
 #include <filesystem>
-#include <regex>
-#include <optional>
+#include <memory>
+#include <map>
+#include <unordered_set>
+#include <algorithm>
+#include <csignal>
 #include "json.hpp"
+#include "walker.hpp"
+#include "parallel.hpp"
+#include "rules.hpp"
+#include "move_plan.hpp"
+#include "journal.hpp"
+#include "watch.hpp"
+#include "migrate.hpp"
+#include "archive.hpp"
+#include "position_index.hpp"
 
 namespace fs = std::filesystem;
 using json = nlohmann::json;
 
 const std::string INPUT_FOLDER = "Evaluation/input";
 const std::string SETTING_FILE = "setting.json";
+const std::string JOURNAL_FOLDER = "Evaluation/journal";
+
+struct Options {
+    bool planOnly = false;
+    bool recover = false;
+    bool watch = false;
+    bool migrate = false;
+    std::string undo;
+    std::string manifest;
+    unsigned jobs = 0;
+};
 
 // Load settings from JSON file
 json loadSettings() {
@@ -22,56 +45,377 @@ json loadSettings() {
     return settings;
 }
 
-// Find setting that matches a filename
-std::optional<json> findSetting(const std::string& filename, const json& settings) {
-    for (const auto& entry : settings) {
-        std::regex pattern(entry["pattern"].get<std::string>());
-        if (std::regex_match(filename, pattern)) {
-            return entry;
+// Print the per-file errors of a batch
+void printErrors(const MoveReport& report) {
+    for (const auto& error : report.errors) {
+        std::cerr << "Error: " << error << "\n";
+    }
+}
+
+// Drop the rows the manifest of `root` already has among `rows` whose
+// path is in `inPlace`
+void dropRecorded(const std::string& root, const std::unordered_set<std::string>& inPlace,
+                  std::vector<ManifestRow>& rows) {
+    std::vector<ManifestRow> existing;
+    std::string error;
+    if (!fs::exists(manifestPath(root)) || !readManifest(root, existing, error)) return;
+    std::unordered_set<std::string> recorded;
+    for (const auto& row : existing) {
+        if (inPlace.count(row.path)) recorded.insert(row.path);
+    }
+    auto known = [&](const ManifestRow& row) { return recorded.count(row.path) > 0; };
+    rows.erase(std::remove_if(rows.begin(), rows.end(), known), rows.end());
+}
+
+// Append a manifest row for every moved game, one write per output root,
+// and add the new KIFs to the root's position index when it has one.
+// Games found in place get a row only if the manifest has none for them.
+void recordGames(const MovePlan& plan, const std::vector<char>& moved, unsigned jobs, MoveReport& report) {
+    std::map<std::string, std::vector<ManifestRow>> byRoot;
+    std::map<std::string, std::unordered_set<std::string>> inPlace;
+    for (size_t i = 0; i < plan.moves.size(); ++i) {
+        if (!moved[i]) continue;
+        const PlannedMove& move = plan.moves[i];
+        fs::path target = plan.dirs[move.dir] / move.name;
+        ManifestRow row;
+        row.game = move.game;
+        row.player = move.rule->player;
+        row.path = target.lexically_relative(move.rule->outputPath).string();
+        struct stat st;
+        if (::stat(target.c_str(), &st) == 0) row.size = static_cast<uint64_t>(st.st_size);
+        if (moved[i] == FOUND_IN_PLACE) inPlace[move.rule->outputPath].insert(row.path);
+        byRoot[move.rule->outputPath].push_back(std::move(row));
+    }
+    for (auto& [root, rows] : byRoot) {
+        std::vector<std::string> kifs;
+        for (const auto& row : rows) {
+            if (fs::path(row.path).extension() == ".kif") kifs.push_back(row.path);
+        }
+        if (inPlace.count(root)) dropRecorded(root, inPlace[root], rows);
+        std::string error;
+        if (!appendManifest(root, rows, error)) report.errors.push_back(error);
+        if (!fs::exists(PositionIndex::pathFor(root))) continue;
+        PositionIndex index;
+        PositionIndex::UpdateStats stats;
+        if (!index.update(root, kifs, jobs, stats, error)) report.errors.push_back(error);
+        for (const auto& e : stats.errors) report.errors.push_back(root + ": not indexed: " + e);
+    }
+}
+
+// Stream the games of a .tar archive to their folders. The archive is
+// removed once every member was written and synced; otherwise it is kept
+// and a rerun skips the games that already exist.
+void importTar(const RuleMatcher& rules, const fs::path& path, const Options& opt) {
+    std::vector<char> written;
+    MoveReport report;
+    MovePlan plan = importArchive(path, rules, opt.planOnly, written, report);
+    if (opt.planOnly) {
+        printErrors(report);
+        std::cout << plan.toJson().dump(2) << "\n";
+        return;
+    }
+    for (const auto& name : plan.unmatched) {
+        std::cerr << "Error: setting for player not found in setting.json: " << path.string() << ": " << name << "\n";
+    }
+    recordGames(plan, written, opt.jobs, report);
+    bool complete = report.errors.empty() && plan.unmatched.empty();
+    std::error_code ec;
+    if (complete) fs::remove(path, ec);
+    printErrors(report);
+    std::cout << "Imported " << report.moved << " of " << plan.moves.size() << " games from " << path.string()
+              << " into " << plan.dirs.size() << " directories" << (complete ? "" : ", archive kept") << "\n";
+}
+
+// Route `names` from the input folder as one journaled batch; archives
+// among them are imported one by one
+void runBatch(const RuleMatcher& rules, const std::vector<std::string>& names, const Options& opt) {
+    std::vector<std::string> files;
+    for (const auto& name : names) {
+        if (archive::isTar(name)) {
+            importTar(rules, fs::path(INPUT_FOLDER) / name, opt);
+        } else {
+            files.push_back(name);
         }
     }
-    return std::nullopt;
+    if (files.empty() && !names.empty()) return;
+    MovePlan plan = buildPlan(INPUT_FOLDER, files, rules);
+
+    if (opt.planOnly) {
+        std::cout << plan.toJson().dump(2) << "\n";
+        return;
+    }
+    for (const auto& name : plan.unmatched) {
+        std::cerr << "Error: setting for player not found in setting.json: " << name << "\n";
+    }
+    if (plan.moves.empty()) return;
+
+    Journal journal;
+    fs::path journalPath = Journal::newPath(JOURNAL_FOLDER);
+    std::string error;
+    if (!journal.create(journalPath, plan, error)) throw std::runtime_error(error);
+    std::vector<char> moved(plan.moves.size(), 0);
+    MoveReport report = executePlan(plan, opt.jobs, [&](size_t i) {
+        journal.done(i);
+        moved[i] = MOVED;
+    });
+    if (!journal.commit(error)) report.errors.push_back(error);
+    recordGames(plan, moved, opt.jobs, report);
+    if (!journal.recorded(error)) report.errors.push_back(error);
+    printErrors(report);
+    std::cout << "Moved " << report.moved << " of " << plan.moves.size() << " files into "
+              << plan.dirs.size() << " directories\n"
+              << "Journal: " << journalPath.string() << "\n";
+}
+
+std::vector<std::string> inboxNames() {
+    std::vector<std::string> names, errors;
+    for (const auto& path : listFiles(INPUT_FOLDER, {1, 0}, errors)) {
+        names.push_back(path.filename().string());
+    }
+    for (const auto& error : errors) std::cerr << "Error: " << error << "\n";
+    return names;
 }
 
-void organizeKif() {
-    json settings = loadSettings();
+void organizeKif(const Options& opt) {
+    RuleMatcher rules(loadSettings());
+    runBatch(rules, inboxNames(), opt);
+}
+
+volatile std::sig_atomic_t stopRequested = 0;
+
+void requestStop(int) { stopRequested = 1; }
+
+// Route files as they arrive until SIGINT/SIGTERM, reloading the rules
+// whenever setting.json changes. A broken setting.json keeps the old rules.
+void watchInbox(const Options& opt) {
+    auto rules = std::make_unique<RuleMatcher>(loadSettings());
+    InboxWatcher watcher;
+    std::string error;
+    if (!watcher.open(INPUT_FOLDER, SETTING_FILE, error)) throw std::runtime_error(error);
+
+    struct sigaction sa {};
+    sa.sa_handler = requestStop;
+    ::sigaction(SIGINT, &sa, nullptr);
+    ::sigaction(SIGTERM, &sa, nullptr);
+
+    // Files that arrived before the watch was in place
+    runBatch(*rules, inboxNames(), opt);
+    std::cout << "Watching " << INPUT_FOLDER << "\n";
+
+    WatchEvents events;
+    while (!stopRequested) {
+        if (!watcher.wait(events, error)) throw std::runtime_error(error);
+        if (events.settingsChanged) {
+            try {
+                rules = std::make_unique<RuleMatcher>(loadSettings());
+                std::cout << "Reloaded " << SETTING_FILE << "\n";
+            } catch (const std::exception& e) {
+                std::cerr << "Error: keeping previous rules: " << e.what() << "\n";
+            }
+        }
+        try {
+            if (events.overflow) {
+                runBatch(*rules, inboxNames(), opt);
+            } else if (!events.files.empty()) {
+                runBatch(*rules, events.files, opt);
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+        }
+    }
+}
 
-    for (const auto& entry : fs::directory_iterator(INPUT_FOLDER)) {
-        if (entry.is_directory()) continue;
+// Output folders of setting.json, each once
+std::vector<std::string> outputRoots(const RuleMatcher& rules) {
+    std::vector<std::string> roots;
+    for (const auto& rule : rules.rules()) {
+        if (std::find(roots.begin(), roots.end(), rule.outputPath) == roots.end()) roots.push_back(rule.outputPath);
+    }
+    return roots;
+}
 
-        std::string filename = entry.path().filename().string();
-        std::string full_path = entry.path().string();
+// Bring manifests and position indexes up to date with the completed moves
+// of a journal whose run stopped before its bookkeeping: migrated games get
+// their new paths, and games routed into an output root are summarized
+// from their files and recorded unless the manifest already has them
+void recordJournal(const RuleMatcher& rules, const JournalContents& contents, unsigned jobs, MoveReport& report) {
+    MovePlan plan;
+    std::vector<char> found;
+    std::map<std::string, uint32_t> dirIndex;
+    for (const auto& root : outputRoots(rules)) {
+        fs::path absRoot = fs::absolute(root).lexically_normal();
+        std::map<std::string, std::string> renamed;
+        for (const JournalEntry& entry : contents.entries) {
+            std::string to, from;
+            if (!entry.done || entry.undone || !relativeTo(entry.target, absRoot, to)) continue;
+            if (relativeTo(entry.source, absRoot, from)) {
+                renamed[from] = to;
+                continue;
+            }
+            fs::path target(entry.target);
+            std::string name = target.filename().string();
+            int dirFd = ::open(target.parent_path().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            struct stat st;
+            if (dirFd < 0 || ::fstatat(dirFd, name.c_str(), &st, 0) != 0) {
+                if (dirFd >= 0) ::close(dirFd);
+                continue;  // moved on since, e.g. by a later migration
+            }
+            const Rule* rule = nullptr;
+            GameSummary game;
+            std::string layout;
+            // Only the rule and summary matter: the game is recorded where
+            // the batch put it, whatever the layout says now
+            resolveInRoot(rules, root, dirFd, name, rule, game, layout);
+            ::close(dirFd);
+            if (!rule) {
+                report.errors.push_back("no rule for " + entry.target + ", not recorded");
+                continue;
+            }
+            fs::path dir = fs::path(root) / fs::path(to).parent_path();
+            auto [it, inserted] = dirIndex.emplace(dir.string(), static_cast<uint32_t>(plan.dirs.size()));
+            if (inserted) plan.dirs.push_back(dir);
+            plan.moves.push_back({name, it->second, rule, std::move(game)});
+            found.push_back(FOUND_IN_PLACE);
+        }
+        renameRecorded(root, renamed, report);
+    }
+    recordGames(plan, found, jobs, report);
+}
 
-        auto matched_setting = findSetting(filename, settings);
-        if (!matched_setting) {
-            std::cerr << "Error: setting for player not found in setting.json\n";
+// Move every output folder of setting.json to its rule's current layout
+void migrateLayouts(const Options& opt) {
+    RuleMatcher rules(loadSettings());
+    for (const auto& root : outputRoots(rules)) {
+        if (!fs::is_directory(root)) continue;
+        Migration migration = planMigration(rules, root, opt.jobs);
+        for (const auto& error : migration.errors) std::cerr << "Error: " << error << "\n";
+        for (const auto& path : migration.unresolved) {
+            std::cerr << "Error: no rule or date for " << path << ", left in place\n";
+        }
+        if (opt.planOnly) {
+            json moves = json::array();
+            for (const auto& move : migration.moves) moves.push_back({{"from", move.source}, {"to", move.target}});
+            std::cout << json({{"root", root}, {"moves", moves}, {"unresolved", migration.unresolved}}).dump(2) << "\n";
+            continue;
+        }
+        if (migration.moves.empty()) {
+            std::cout << root << ": already in layout\n";
             continue;
         }
+        Journal journal;
+        fs::path journalPath = Journal::newPath(JOURNAL_FOLDER);
+        std::string error;
+        if (!journal.create(journalPath, migration.moves, error)) throw std::runtime_error(error);
+        MoveReport report = executeMigration(migration, opt.jobs, journal);
+        if (!journal.commit(error) || !journal.recorded(error)) report.errors.push_back(error);
+        printErrors(report);
+        std::cout << root << ": migrated " << report.moved << " of " << migration.moves.size() << " files\n"
+                  << "Journal: " << journalPath.string() << "\n";
+    }
+}
 
-        std::string pattern = (*matched_setting)["pattern"];
-        std::string output_path = (*matched_setting)["output_path"];
+// Print the manifest of an output root as tab-separated rows
+void printManifest(const Options& opt) {
+    std::vector<ManifestRow> rows;
+    std::string error;
+    if (!readManifest(opt.manifest, rows, error)) throw std::runtime_error(error);
+    for (const auto& row : rows) {
+        std::cout << row.game.date << '\t' << row.player << '\t' << sideName(row.game.format, row.game.side)
+                  << '\t' << outcomeName(row.game.result) << '\t' << row.game.opponent() << '\t' << row.path
+                  << '\t' << row.size << '\n';
+    }
+}
 
-        std::smatch match;
-        if (std::regex_match(filename, match, std::regex(pattern))) {
-            std::string date_str = match[1];
-            fs::path target_folder = fs::path(output_path) / date_str;
+// Reverse every move recorded in a journal, then update the manifest and
+// position index of every output folder the batch touched
+void undoBatch(const Options& opt) {
+    std::vector<JournalEntry> restored;
+    MoveReport report = undoJournal(opt.undo, opt.jobs, restored);
+    if (!restored.empty()) {
+        RuleMatcher rules(loadSettings());
+        for (const auto& root : outputRoots(rules)) revertMoves(root, restored, report);
+    }
+    printErrors(report);
+    std::cout << "Restored " << report.moved << " files from " << opt.undo << "\n";
+}
 
-            if (!fs::exists(target_folder)) {
-                fs::create_directories(target_folder);
-            }
+// Complete every batch whose journal has no commit record, and redo the
+// manifest and index bookkeeping of every batch that stopped before it
+void recoverBatches(const Options& opt) {
+    std::error_code ec;
+    std::unique_ptr<RuleMatcher> rules;
+    size_t batches = 0;
+    for (const auto& entry : fs::directory_iterator(JOURNAL_FOLDER, ec)) {
+        if (entry.path().extension() != ".kifjrn") continue;
+        JournalContents contents;
+        std::string error;
+        if (!Journal::read(entry.path(), contents, error)) {
+            std::cerr << "Error: " << error << "\n";
+            continue;
+        }
+        if (contents.committed && contents.recorded) continue;
+        MoveReport report;
+        if (!contents.committed) {
+            report = recoverJournal(entry.path(), opt.jobs);
+            contents = JournalContents();
+            if (!Journal::read(entry.path(), contents, error)) report.errors.push_back(error);
+        }
+        if (!rules) rules = std::make_unique<RuleMatcher>(loadSettings());
+        recordJournal(*rules, contents, opt.jobs, report);
+        Journal journal;
+        if (!journal.reopen(entry.path(), contents, error) || !journal.recorded(error)) report.errors.push_back(error);
+        printErrors(report);
+        std::cout << "Recovered " << entry.path().string() << ": completed " << report.moved << " moves\n";
+        ++batches;
+    }
+    if (batches == 0) std::cout << "No interrupted batches in " << JOURNAL_FOLDER << "\n";
+}
 
-            fs::path output_file_path = target_folder / filename;
-            fs::rename(full_path, output_file_path);
+bool parseArgs(int argc, char* argv[], Options& opt) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--plan") {
+            opt.planOnly = true;
+        } else if (arg == "--undo" && i + 1 < argc) {
+            opt.undo = argv[++i];
+        } else if (arg == "--manifest" && i + 1 < argc) {
+            opt.manifest = argv[++i];
+        } else if (arg == "--migrate") {
+            opt.migrate = true;
+        } else if (arg == "--watch") {
+            opt.watch = true;
+        } else if (arg == "--recover") {
+            opt.recover = true;
+        } else if (arg == "--jobs" && i + 1 < argc) {
+            if (!parseCount(argv[++i], opt.jobs)) return false;
         } else {
-            std::cout << "Pattern did not match filename: " << filename << "\n";
-            std::cout << "Using pattern: " << pattern << "\n";
+            return false;
         }
     }
+    if (opt.jobs == 0) opt.jobs = std::max(1u, std::thread::hardware_concurrency());
+    return true;
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+    Options opt;
+    if (!parseArgs(argc, argv, opt)) {
+        std::cerr << "Usage: organize_kif [--plan] [--migrate | --watch | --undo <journal> | --recover | --manifest <output_path>] [--jobs N]\n";
+        return 1;
+    }
     try {
-        organizeKif();
+        if (!opt.undo.empty()) {
+            undoBatch(opt);
+        } else if (!opt.manifest.empty()) {
+            printManifest(opt);
+        } else if (opt.migrate) {
+            migrateLayouts(opt);
+        } else if (opt.recover) {
+            recoverBatches(opt);
+        } else if (opt.watch) {
+            watchInbox(opt);
+        } else {
+            organizeKif(opt);
+        }
     } catch (const std::exception& e) {
         std::cerr << "Fatal error: " << e.what() << "\n";
         return 1;
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <charconv>
+#include <cstddef>
+#include <cstring>
+
+// Run fn(worker, i) for every i in [0, n) on `threads` threads (the caller
+// included). `worker` is the thread's number in [0, threads), so fn can keep
+// per-thread state in an array without locking. Indices are handed out one
+// at a time, so uneven items balance themselves.
+template <typename Fn>
+void parallelForWorkers(size_t n, unsigned threads, Fn fn) {
+    std::atomic<size_t> next{0};
+    auto worker = [&](unsigned w) {
+        for (size_t i = next++; i < n; i = next++) fn(w, i);
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads && t < n; ++t) pool.emplace_back(worker, t);
+    worker(0);
+    for (auto& th : pool) th.join();
+}
+
+// Parse a thread or job count from the command line: a positive decimal
+// that fills the whole argument ("3x" and out-of-range values fail)
+inline bool parseCount(const char* text, unsigned& count) {
+    const char* end = text + std::strlen(text);
+    unsigned value = 0;
+    auto [ptr, ec] = std::from_chars(text, end, value);
+    if (ec != std::errc() || ptr != end || value == 0) return false;
+    count = value;
+    return true;
+}
+
+// Run fn(i) for every i in [0, n) on `threads` threads (the caller included)
+template <typename Fn>
+void parallelFor(size_t n, unsigned threads, Fn fn) {
+    parallelForWorkers(n, threads, [&](unsigned, size_t i) { fn(i); });
+}
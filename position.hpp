@@ -0,0 +1,655 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <cstdint>
+#include "kif.hpp"
+
+// Shogi board state for replaying and checking KIF games. Pieces are kept
+// both in a mailbox (one byte per square) and in 81-bit bitboards per
+// colour and piece type; hands are small counters. A Zobrist key is
+// updated incrementally by doMove and restored by undoMove from a stack of
+// per-move state. The keys come from a fixed seed, so a position hashes to
+// the same value in every run and keys can be stored on disk.
+//
+// Squares are numbered (file - 1) * 9 + (rank - 1): 0 is １一, 80 is ９九.
+// Sente moves towards rank 1. A Move is 16 bits: the to-square in bits
+// 0-6, the from-square (or 81 + piece for a drop) in bits 7-13 and the
+// promotion flag in bit 14.
+
+namespace shogi {
+
+using kif::Piece;
+using kif::NoPiece, kif::Pawn, kif::Lance, kif::Knight, kif::Silver, kif::Gold, kif::Bishop, kif::Rook, kif::King;
+using kif::ProPawn, kif::ProLance, kif::ProKnight, kif::ProSilver, kif::Horse, kif::Dragon;
+
+enum Color : uint8_t { Sente, Gote };
+
+inline Color operator~(Color c) { return static_cast<Color>(c ^ 1); }
+
+__extension__ typedef unsigned __int128 Bitboard;
+
+constexpr int SQUARES = 81;
+constexpr int PIECE_TYPES = 15;  // NoPiece .. Dragon
+constexpr int HAND_TYPES = 8;    // NoPiece .. Rook; only Pawn .. Rook are used
+
+inline int square(int file, int rank) { return (file - 1) * 9 + (rank - 1); }
+inline int fileOf(int sq) { return sq / 9 + 1; }
+inline int rankOf(int sq) { return sq % 9 + 1; }
+inline Bitboard bit(int sq) { return Bitboard(1) << sq; }
+
+// Index of the lowest set square, which is then cleared
+inline int popSquare(Bitboard& b) {
+    uint64_t low = static_cast<uint64_t>(b);
+    int sq = low ? __builtin_ctzll(low) : 64 + __builtin_ctzll(static_cast<uint64_t>(b >> 64));
+    b &= b - 1;
+    return sq;
+}
+
+inline int popCount(Bitboard b) {
+    return __builtin_popcountll(static_cast<uint64_t>(b)) + __builtin_popcountll(static_cast<uint64_t>(b >> 64));
+}
+
+using Move = uint16_t;
+constexpr Move NO_MOVE = 0;
+
+inline Move makeMove(int from, int to, bool promote) {
+    return static_cast<Move>(to | from << 7 | (promote ? 1 << 14 : 0));
+}
+inline Move makeDrop(Piece piece, int to) { return static_cast<Move>(to | (SQUARES + piece) << 7); }
+inline int moveTo(Move m) { return m & 0x7F; }
+inline int moveFrom(Move m) { return m >> 7 & 0x7F; }
+inline bool isDrop(Move m) { return moveFrom(m) >= SQUARES; }
+inline bool isPromotion(Move m) { return m >> 14 & 1; }
+inline Piece dropPiece(Move m) { return static_cast<Piece>(moveFrom(m) - SQUARES); }
+
+inline bool canPromote(Piece p) { return p >= Pawn && p <= Rook && p != Gold; }
+
+inline Piece promote(Piece p) {
+    switch (p) {
+        case Pawn: return ProPawn;
+        case Lance: return ProLance;
+        case Knight: return ProKnight;
+        case Silver: return ProSilver;
+        case Bishop: return Horse;
+        case Rook: return Dragon;
+        default: return p;
+    }
+}
+
+inline Piece unpromote(Piece p) {
+    switch (p) {
+        case ProPawn: return Pawn;
+        case ProLance: return Lance;
+        case ProKnight: return Knight;
+        case ProSilver: return Silver;
+        case Horse: return Bishop;
+        case Dragon: return Rook;
+        default: return p;
+    }
+}
+
+// Ranks from the mover's side: 1 is the far rank
+inline int relativeRank(Color c, int sq) { return c == Sente ? rankOf(sq) : 10 - rankOf(sq); }
+
+inline bool inZone(Color c, int sq) { return relativeRank(c, sq) <= 3; }
+
+// A pawn or lance on the far rank, or a knight on the far two, could never move
+inline bool deadEnd(Color c, Piece p, int sq) {
+    return (p == Pawn || p == Lance) ? relativeRank(c, sq) == 1 : p == Knight && relativeRank(c, sq) <= 2;
+}
+
+namespace detail {
+
+// Directions as (file, rank) steps from Sente's side; gote mirrors the rank
+constexpr int DIRS[8][2] = {{0, -1}, {0, 1}, {1, 0}, {-1, 0}, {1, -1}, {-1, -1}, {1, 1}, {-1, 1}};
+constexpr uint8_t RAY_END = 0xFF;
+
+struct Tables {
+    // Non-sliding moves and the step part of Horse and Dragon; for Lance,
+    // Bishop and Rook the lines they cover on an empty board
+    Bitboard step[2][PIECE_TYPES][SQUARES] = {};
+    uint8_t ray[SQUARES][8][9];                   // squares along each direction, RAY_END-terminated
+    Bitboard between[SQUARES][SQUARES] = {};      // squares strictly between two on a line
+    Bitboard file[10] = {};
+    uint64_t pieceKey[2][PIECE_TYPES][SQUARES];
+    uint64_t handKey[2][HAND_TYPES][19] = {};     // [0] stays 0, so an empty hand adds nothing
+    uint64_t sideKey;
+
+    Tables() {
+        uint64_t seed = 0x5348'4F47'4921'2025ull;
+        auto random = [&seed]() {  // splitmix64
+            uint64_t z = (seed += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            return z ^ (z >> 31);
+        };
+        for (auto& side : pieceKey) for (auto& piece : side) for (auto& key : piece) key = random();
+        for (auto& side : handKey) for (auto& piece : side) for (int n = 1; n < 19; ++n) piece[n] = random();
+        sideKey = random();
+
+        for (int sq = 0; sq < SQUARES; ++sq) {
+            file[fileOf(sq)] |= bit(sq);
+            for (int d = 0; d < 8; ++d) {
+                int f = fileOf(sq), r = rankOf(sq), len = 0;
+                Bitboard passed = 0;
+                while (true) {
+                    f += DIRS[d][0];
+                    r += DIRS[d][1];
+                    if (f < 1 || f > 9 || r < 1 || r > 9) break;
+                    int to = square(f, r);
+                    ray[sq][d][len++] = static_cast<uint8_t>(to);
+                    between[sq][to] = passed;
+                    passed |= bit(to);
+                    for (int c = 0; c < 2; ++c) {
+                        if (d < 4) step[c][Rook][sq] |= bit(to);
+                        if (d >= 4) step[c][Bishop][sq] |= bit(to);
+                    }
+                    if (d == 0) step[Sente][Lance][sq] |= bit(to);
+                    if (d == 1) step[Gote][Lance][sq] |= bit(to);
+                }
+                ray[sq][d][len] = RAY_END;
+            }
+            for (int c = 0; c < 2; ++c) {
+                int forward = c == Sente ? 1 : -1;
+                auto add = [&](Piece p, int df, int dr) {
+                    int f = fileOf(sq) + df, r = rankOf(sq) + dr * forward;
+                    if (f >= 1 && f <= 9 && r >= 1 && r <= 9) step[c][p][sq] |= bit(square(f, r));
+                };
+                add(Pawn, 0, -1);
+                add(Knight, 1, -2);
+                add(Knight, -1, -2);
+                for (int d : {0, 4, 5, 6, 7}) add(Silver, DIRS[d][0], DIRS[d][1]);
+                for (int d : {0, 1, 2, 3, 4, 5}) add(Gold, DIRS[d][0], DIRS[d][1]);
+                for (int d = 0; d < 8; ++d) add(King, DIRS[d][0], DIRS[d][1]);
+                for (int d : {0, 1, 2, 3}) add(Horse, DIRS[d][0], DIRS[d][1]);
+                for (int d : {4, 5, 6, 7}) add(Dragon, DIRS[d][0], DIRS[d][1]);
+                for (Piece p : {ProPawn, ProLance, ProKnight, ProSilver}) step[c][p][sq] = step[c][Gold][sq];
+            }
+        }
+    }
+};
+
+inline const Tables& tables() {
+    static const Tables t;
+    return t;
+}
+
+}  // namespace detail
+
+// Squares reached from `sq` along directions [first, last), up to and
+// including the first occupied one
+inline Bitboard slide(int sq, int first, int last, Bitboard occupied) {
+    const detail::Tables& t = detail::tables();
+    Bitboard attacks = 0;
+    for (int d = first; d < last; ++d) {
+        for (const uint8_t* s = t.ray[sq][d]; *s != detail::RAY_END; ++s) {
+            attacks |= bit(*s);
+            if (occupied & bit(*s)) break;
+        }
+    }
+    return attacks;
+}
+
+inline Bitboard attacksFrom(Color c, Piece p, int sq, Bitboard occupied) {
+    const detail::Tables& t = detail::tables();
+    switch (p) {
+        case Lance: return slide(sq, c == Sente ? 0 : 1, c == Sente ? 1 : 2, occupied);
+        case Bishop: return slide(sq, 4, 8, occupied);
+        case Rook: return slide(sq, 0, 4, occupied);
+        case Horse: return slide(sq, 4, 8, occupied) | t.step[c][Horse][sq];
+        case Dragon: return slide(sq, 0, 4, occupied) | t.step[c][Dragon][sq];
+        default: return t.step[c][p][sq];
+    }
+}
+
+// Legal moves never exceed 593 in any shogi position
+struct MoveList {
+    std::array<Move, 600> moves;
+    int size = 0;
+
+    void push(Move m) { moves[size++] = m; }
+    const Move* begin() const { return moves.data(); }
+    const Move* end() const { return moves.data() + size; }
+};
+
+class Position {
+public:
+    Position() { setStart(); }
+
+    // The standard starting position, sente to move
+    void setStart() {
+        static const Position start(Start{});
+        *this = start;
+    }
+
+
+    // The starting position of a game: its diagram and hands if it has one,
+    // else the 手合割 (平手 or a standard handicap, gote moving first)
+    bool set(const kif::Record& record, std::string& error) {
+        if (!record.board.empty()) return setDiagram(record, error);
+        setStart();
+        const std::string_view* handicap = record.find("\xE6\x89\x8B\xE5\x90\x88\xE5\x89\xB2");  // 手合割
+        if (!handicap) return true;
+        std::string name = record.text(*handicap);
+        if (name == "\xE5\xB9\xB3\xE6\x89\x8B") return true;  // 平手
+        // Gote's pieces removed by each handicap, as file * 10 + rank
+        static const struct {
+            const char* name;
+            std::vector<int> squares;
+        } handicaps[] = {
+            {"\xE9\xA6\x99\xE8\x90\xBD\xE3\x81\xA1", {11}},                                   // 香落ち
+            {"\xE5\x8F\xB3\xE9\xA6\x99\xE8\x90\xBD\xE3\x81\xA1", {91}},                       // 右香落ち
+            {"\xE8\xA7\x92\xE8\x90\xBD\xE3\x81\xA1", {22}},                                   // 角落ち
+            {"\xE9\xA3\x9B\xE8\xBB\x8A\xE8\x90\xBD\xE3\x81\xA1", {82}},                       // 飛車落ち
+            {"\xE9\xA3\x9B\xE9\xA6\x99\xE8\x90\xBD\xE3\x81\xA1", {82, 11}},                   // 飛香落ち
+            {"\xE4\xBA\x8C\xE6\x9E\x9A\xE8\x90\xBD\xE3\x81\xA1", {82, 22}},                   // 二枚落ち
+            {"\xE4\xB8\x89\xE6\x9E\x9A\xE8\x90\xBD\xE3\x81\xA1", {82, 22, 11}},               // 三枚落ち
+            {"\xE5\x9B\x9B\xE6\x9E\x9A\xE8\x90\xBD\xE3\x81\xA1", {82, 22, 11, 91}},           // 四枚落ち
+            {"\xE5\x85\xAD\xE6\x9E\x9A\xE8\x90\xBD\xE3\x81\xA1", {82, 22, 11, 91, 21, 81}},   // 六枚落ち
+            {"\xE5\x85\xAB\xE6\x9E\x9A\xE8\x90\xBD\xE3\x81\xA1", {82, 22, 11, 91, 21, 81, 31, 71}},  // 八枚落ち
+            {"\xE5\x8D\x81\xE6\x9E\x9A\xE8\x90\xBD\xE3\x81\xA1", {82, 22, 11, 91, 21, 81, 31, 71, 41, 61}},  // 十枚落ち
+        };
+        for (const auto& h : handicaps) {
+            if (name != h.name) continue;
+            for (int fr : h.squares) remove(square(fr / 10, fr % 10));
+            side_ = Gote;
+            key_ ^= detail::tables().sideKey;
+            return true;
+        }
+        error = "unsupported handicap " + name;
+        return false;
+    }
+
+    Color side() const { return side_; }
+    uint64_t key() const { return key_; }
+    Piece pieceAt(int sq) const { return static_cast<Piece>(board_[sq] & 15); }
+    Color colorAt(int sq) const { return static_cast<Color>(board_[sq] >> 4); }
+    int hand(Color c, Piece p) const { return hand_[c][p]; }
+    int king(Color c) const { return king_[c]; }
+    Bitboard occupied() const { return byColor_[Sente] | byColor_[Gote]; }
+    Bitboard pieces(Color c) const { return byColor_[c]; }
+    Bitboard pieces(Color c, Piece p) const { return byColor_[c] & byPiece_[p]; }
+
+    // Pieces of colour `by` that attack `sq`. Sliders are found on the
+    // empty-board lines through `sq` and kept if nothing stands between.
+    Bitboard attackers(int sq, Color by, Bitboard occupied) const {
+        const detail::Tables& t = detail::tables();
+        Color them = ~by;  // moves are symmetric: look from the target's side
+        Bitboard golds = byPiece_[Gold] | byPiece_[ProPawn] | byPiece_[ProLance] | byPiece_[ProKnight] | byPiece_[ProSilver];
+        Bitboard found = (t.step[them][Pawn][sq] & byPiece_[Pawn]) | (t.step[them][Knight][sq] & byPiece_[Knight]) |
+                         (t.step[them][Silver][sq] & byPiece_[Silver]) | (t.step[them][Gold][sq] & golds) |
+                         (t.step[them][King][sq] & (byPiece_[King] | byPiece_[Horse] | byPiece_[Dragon]));
+        Bitboard sliders = (t.step[them][Lance][sq] & byPiece_[Lance]) |
+                           (t.step[them][Bishop][sq] & (byPiece_[Bishop] | byPiece_[Horse])) |
+                           (t.step[them][Rook][sq] & (byPiece_[Rook] | byPiece_[Dragon]));
+        for (sliders &= byColor_[by]; sliders;) {
+            int from = popSquare(sliders);
+            if (!(t.between[sq][from] & occupied)) found |= bit(from);
+        }
+        return found & byColor_[by];
+    }
+
+    bool attacked(int sq, Color by) const { return attackers(sq, by, occupied()) != 0; }
+
+    bool inCheck() const { return king_[side_] >= 0 && attacked(king_[side_], ~side_); }
+
+    void doMove(Move m) {
+        const detail::Tables& t = detail::tables();
+        states_.push_back({key_, NoPiece});
+        int to = moveTo(m);
+        if (isDrop(m)) {
+            Piece p = dropPiece(m);
+            key_ ^= t.handKey[side_][p][hand_[side_][p]] ^ t.handKey[side_][p][hand_[side_][p] - 1];
+            --hand_[side_][p];
+            put(side_, p, to);
+        } else {
+            int from = moveFrom(m);
+            Piece p = pieceAt(from);
+            if (board_[to]) {
+                Piece captured = pieceAt(to);
+                states_.back().captured = captured;
+                remove(to);
+                Piece base = unpromote(captured);
+                ++hand_[side_][base];
+                key_ ^= t.handKey[side_][base][hand_[side_][base]] ^ t.handKey[side_][base][hand_[side_][base] - 1];
+            }
+            remove(from);
+            put(side_, isPromotion(m) ? promote(p) : p, to);
+        }
+        side_ = ~side_;
+        key_ ^= t.sideKey;
+    }
+
+    void undoMove(Move m) {
+        side_ = ~side_;
+        State st = states_.back();
+        states_.pop_back();
+        int to = moveTo(m);
+        if (isDrop(m)) {
+            remove(to);
+            ++hand_[side_][dropPiece(m)];
+        } else {
+            Piece p = pieceAt(to);
+            remove(to);
+            put(side_, isPromotion(m) ? unpromote(p) : p, moveFrom(m));
+            if (st.captured != NoPiece) {
+                put(~side_, st.captured, to);
+                --hand_[side_][unpromote(st.captured)];
+            }
+        }
+        key_ = st.key;
+    }
+
+    // Every move that follows the piece movement and drop rules, including
+    // ones that leave the own king in check
+    void pseudoLegalMoves(MoveList& list) const {
+        const Color us = side_;
+        const Bitboard occ = occupied();
+        Bitboard targets = ~byColor_[us];
+        if (king_[~us] >= 0) targets &= ~bit(king_[~us]);  // kings are never captured
+        for (Bitboard own = byColor_[us]; own;) {
+            int from = popSquare(own);
+            Piece p = pieceAt(from);
+            Bitboard attacks = attacksFrom(us, p, from, occ) & targets;
+            while (attacks) {
+                int to = popSquare(attacks);
+                if (canPromote(p) && (inZone(us, from) || inZone(us, to))) list.push(makeMove(from, to, true));
+                if (!deadEnd(us, p, to)) list.push(makeMove(from, to, false));
+            }
+        }
+        const detail::Tables& t = detail::tables();
+        for (int p = Pawn; p <= Rook; ++p) {
+            if (hand_[us][p] == 0) continue;
+            for (Bitboard empty = ~occ & ((Bitboard(1) << SQUARES) - 1); empty;) {
+                int to = popSquare(empty);
+                if (deadEnd(us, static_cast<Piece>(p), to)) continue;
+                if (p == Pawn && (pieces(us, Pawn) & t.file[fileOf(to)])) continue;  // 二歩
+                list.push(makeDrop(static_cast<Piece>(p), to));
+            }
+        }
+    }
+
+    // A pseudo-legal move is legal unless it leaves the own king attacked
+    // or is a pawn drop that mates (打ち歩詰め)
+    bool legal(Move m) {
+        Color us = side_;
+        doMove(m);
+        bool ok = king_[us] < 0 || !attacked(king_[us], side_);
+        if (ok && isDrop(m) && dropPiece(m) == Pawn && king_[side_] >= 0 &&
+            (detail::tables().step[us][Pawn][moveTo(m)] & bit(king_[side_])) && !hasLegalMove()) {
+            ok = false;
+        }
+        undoMove(m);
+        return ok;
+    }
+
+    void legalMoves(MoveList& list) {
+        MoveList pseudo;
+        pseudoLegalMoves(pseudo);
+        list.size = 0;
+        for (Move m : pseudo) {
+            if (legal(m)) list.push(m);
+        }
+    }
+
+    // Check a parsed KIF move against the board and play it as `m`. Returns
+    // false with `error` set, and the position unchanged, if the piece is
+    // not there, cannot reach the square, may not (or must) promote, or if
+    // the move is illegal.
+    bool doKifMove(const kif::Move& km, Move& m, std::string& error) {
+        const Color us = side_;
+        auto fail = [&](const char* why) {
+            error = "move " + std::to_string(km.ply) + ": " + why;
+            return false;
+        };
+        if (km.to < 11 || km.to % 10 == 0) return fail("no target square");
+        int to = square(km.to / 10, km.to % 10);
+        if (km.drop || (km.from == 0 && km.piece <= Rook && hand_[us][km.piece] > 0)) {  // 打 may be omitted
+            if (km.piece < Pawn || km.piece > Rook || hand_[us][km.piece] == 0) return fail("piece not in hand");
+            if (board_[to]) return fail("drop on an occupied square");
+            if (deadEnd(us, km.piece, to)) return fail("drop where the piece cannot move");
+            if (km.piece == Pawn && (pieces(us, Pawn) & detail::tables().file[fileOf(to)])) return fail("two pawns on a file");
+            m = makeDrop(km.piece, to);
+        } else {
+            if (km.from < 11 || km.from % 10 == 0) return fail("no source square");
+            int from = square(km.from / 10, km.from % 10);
+            if (!board_[from] || colorAt(from) != us || pieceAt(from) != km.piece) return fail("piece not on the source square");
+            if (!(attacksFrom(us, km.piece, from, occupied()) & bit(to)) || (board_[to] && colorAt(to) == us)) {
+                return fail("piece cannot reach the square");
+            }
+            if (board_[to] && pieceAt(to) == King) return fail("king captured");
+            if (km.promote && !(canPromote(km.piece) && (inZone(us, from) || inZone(us, to)))) return fail("promotion not allowed");
+            if (!km.promote && deadEnd(us, km.piece, to)) return fail("promotion required");
+            m = makeMove(from, to, km.promote);
+        }
+        doMove(m);
+        if (king_[us] >= 0 && attacked(king_[us], side_)) {
+            undoMove(m);
+            return fail("king left in check");
+        }
+        if (isDrop(m) && km.piece == Pawn && king_[side_] >= 0 &&
+            (detail::tables().step[us][Pawn][to] & bit(king_[side_])) && !hasLegalMove()) {
+            undoMove(m);
+            return fail("mate by a pawn drop");
+        }
+        return true;
+    }
+
+private:
+    struct Start {};
+
+    // The position setStart copies
+    explicit Position(Start) {
+        clear();
+        static const Piece backRank[9] = {Lance, Knight, Silver, Gold, King, Gold, Silver, Knight, Lance};
+        for (int f = 1; f <= 9; ++f) {
+            put(Gote, backRank[f - 1], square(f, 1));
+            put(Gote, Pawn, square(f, 3));
+            put(Sente, Pawn, square(f, 7));
+            put(Sente, backRank[f - 1], square(f, 9));
+        }
+        put(Gote, Rook, square(8, 2));
+        put(Gote, Bishop, square(2, 2));
+        put(Sente, Bishop, square(8, 8));
+        put(Sente, Rook, square(2, 8));
+    }
+
+    struct State {
+        uint64_t key;
+        Piece captured;
+    };
+
+    void clear() {
+        for (auto& sq : board_) sq = 0;
+        for (auto& b : byColor_) b = 0;
+        for (auto& b : byPiece_) b = 0;
+        for (auto& side : hand_) for (auto& n : side) n = 0;
+        king_[Sente] = king_[Gote] = -1;
+        side_ = Sente;
+        key_ = 0;
+        states_.clear();
+    }
+
+    void put(Color c, Piece p, int sq) {
+        board_[sq] = static_cast<uint8_t>(p | c << 4);
+        byColor_[c] |= bit(sq);
+        byPiece_[p] |= bit(sq);
+        if (p == King) king_[c] = sq;
+        key_ ^= detail::tables().pieceKey[c][p][sq];
+    }
+
+    void remove(int sq) {
+        Color c = colorAt(sq);
+        Piece p = pieceAt(sq);
+        board_[sq] = 0;
+        byColor_[c] &= ~bit(sq);
+        byPiece_[p] &= ~bit(sq);
+        key_ ^= detail::tables().pieceKey[c][p][sq];
+    }
+
+    // Any legal board move for the side to move; only used to test whether
+    // a pawn-drop check is mate, which no drop can answer
+    bool hasLegalMove() {
+        MoveList pseudo;
+        pseudoLegalMoves(pseudo);
+        for (Move m : pseudo) {
+            if (isDrop(m)) continue;
+            Color us = side_;
+            doMove(m);
+            bool ok = !attacked(king_[us], side_);
+            undoMove(m);
+            if (ok) return true;
+        }
+        return false;
+    }
+
+    // Hand text such as "金 歩二" or "歩三　金　"; なし is empty
+    bool setHand(Color c, const kif::Record& record, const char* key, const char* altKey, std::string& error) {
+        const std::string_view* value = record.find(key);
+        if (!value) value = record.find(altKey);
+        if (!value) return true;
+        const kif::Encoding enc = record.encoding;
+        std::string_view text = *value;
+        size_t i = 0;
+        Piece piece = NoPiece;
+        int count = 0;
+        auto flush = [&]() {
+            if (piece != NoPiece) {
+                int n = std::min(count ? count : 1, 18 - hand_[c][piece]);
+                key_ ^= detail::tables().handKey[c][piece][hand_[c][piece]] ^ detail::tables().handKey[c][piece][hand_[c][piece] + n];
+                hand_[c][piece] = static_cast<uint8_t>(hand_[c][piece] + n);
+            }
+            piece = NoPiece;
+            count = 0;
+        };
+        while (i < text.size()) {
+            uint32_t cp = kif::detail::next(enc, text, i);
+            Piece p = kif::detail::pieceOf(cp);
+            if (p >= Pawn && p <= Rook) {
+                flush();
+                piece = p;
+            } else if (cp == 0x5341) {  // 十
+                count += 10;
+            } else if (int digit = kif::detail::rankDigit(cp)) {
+                count += digit;
+            } else if (cp == 0x306A || cp == 0x3057) {  // なし
+                continue;
+            } else if (cp != ' ' && cp != kif::detail::IDEOGRAPHIC_SPACE) {
+                error = "unreadable hand: " + record.text(text);
+                return false;
+            }
+        }
+        flush();
+        return true;
+    }
+
+    // Rows like "|v香 ・ ・ ・ ・ ・v玉v桂v香|一": a 'v' marks gote's pieces
+    bool setDiagram(const kif::Record& record, std::string& error) {
+        clear();
+        const kif::Encoding enc = record.encoding;
+        std::string_view rows = record.board;
+        std::string_view dot = enc == kif::Encoding::Utf8 ? "\xE3\x83\xBB" : "\x81\x45";  // ・
+        size_t i = 0;
+        int rank = 0;
+        while (i < rows.size()) {
+            size_t end = rows.find('\n', i);
+            if (end == std::string_view::npos) end = rows.size();
+            std::string_view row = rows.substr(i, end - i);
+            i = end + 1;
+            if (++rank > 9 || row.empty() || row[0] != '|') {
+                error = "malformed board diagram";
+                return false;
+            }
+            size_t k = 1;
+            for (int file = 9; file >= 1; --file) {
+                if (k >= row.size()) break;
+                char mark = row[k++];
+                if (row.compare(k, dot.size(), dot) == 0) {  // most squares are empty
+                    k += dot.size();
+                    continue;
+                }
+                Piece p = kif::detail::pieceOf(kif::detail::next(enc, row, k));
+                if (p == NoPiece || (mark != ' ' && mark != 'v')) {
+                    error = "malformed board diagram";
+                    return false;
+                }
+                put(mark == 'v' ? Gote : Sente, p, square(file, rank));
+            }
+        }
+        if (rank != 9) {
+            error = "malformed board diagram";
+            return false;
+        }
+        if (!setHand(Sente, record, "\xE5\x85\x88\xE6\x89\x8B\xE3\x81\xAE\xE6\x8C\x81\xE9\xA7\x92",       // 先手の持駒
+                     "\xE4\xB8\x8B\xE6\x89\x8B\xE3\x81\xAE\xE6\x8C\x81\xE9\xA7\x92", error) ||          // 下手の持駒
+            !setHand(Gote, record, "\xE5\xBE\x8C\xE6\x89\x8B\xE3\x81\xAE\xE6\x8C\x81\xE9\xA7\x92",        // 後手の持駒
+                     "\xE4\xB8\x8A\xE6\x89\x8B\xE3\x81\xAE\xE6\x8C\x81\xE9\xA7\x92", error)) {          // 上手の持駒
+            return false;
+        }
+        if (record.goteToMove) {
+            side_ = Gote;
+            key_ ^= detail::tables().sideKey;
+        }
+        // The side to move could capture a king in check, which no move
+        // representation here allows
+        if (king_[~side_] >= 0 && attacked(king_[~side_], side_)) {
+            error = "board diagram leaves the side not to move in check";
+            return false;
+        }
+        return true;
+    }
+
+    uint8_t board_[SQUARES];  // piece | colour << 4, 0 for empty
+    Bitboard byColor_[2];
+    Bitboard byPiece_[PIECE_TYPES];
+    uint8_t hand_[2][HAND_TYPES];
+    int king_[2];
+    Color side_;
+    uint64_t key_;
+    std::vector<State> states_;
+};
+
+// Replay the main line of `record` from its starting position, checking
+// every move. moves[k] is the k-th move and keys[k] the key of the position
+// after k moves (keys[0] is the start). Replay stops at 投了 and other
+// final moves; returns false with `error` set at the first bad move.
+inline bool replay(const kif::Record& record, Position& pos, std::vector<Move>& moves, std::vector<uint64_t>& keys,
+                   std::string& error) {
+    moves.clear();
+    keys.clear();
+    if (!pos.set(record, error)) return false;
+    keys.push_back(pos.key());
+    for (size_t i = 0; i < record.moves.size(); ++i) {
+        const kif::Move& km = record.moves[i];
+        if (km.special()) {
+            if (i + 1 == record.moves.size()) break;
+            error = "move " + std::to_string(km.ply) + ": unrecognized move " + record.text(km.text);
+            return false;
+        }
+        Move m;
+        if (!pos.doKifMove(km, m, error)) return false;
+        moves.push_back(m);
+        keys.push_back(pos.key());
+    }
+    return true;
+}
+
+// Leaf count of the legal move tree `depth` plies deep
+inline uint64_t perft(Position& pos, int depth) {
+    MoveList list;
+    pos.legalMoves(list);
+    if (depth <= 1) return depth == 1 ? static_cast<uint64_t>(list.size) : 1;
+    uint64_t nodes = 0;
+    for (Move m : list) {
+        pos.doMove(m);
+        nodes += perft(pos, depth - 1);
+        pos.undoMove(m);
+    }
+    return nodes;
+}
+
+}  // namespace shogi
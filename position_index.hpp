@@ -0,0 +1,617 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <queue>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <unordered_set>
+#include <filesystem>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "kif.hpp"
+#include "position.hpp"
+#include "parallel.hpp"
+
+// Every position reached by the games below a folder, stored next to it as
+// .<folder>.kifpos: a sorted table of Zobrist keys (shogi::Position::key)
+// with, for each, the (game, ply) pairs where it occurred. The file is
+// memory-mapped and holds:
+//
+//   Header
+//   uint8_t  postings[]           per key, (game, ply) pairs sorted by game
+//                                 then ply as LEB128 varints: the game delta,
+//                                 then the ply (a delta within one game)
+//   uint64_t key[keys]            sorted
+//   uint32_t postingOffset[keys + 1]
+//   uint32_t pathOffset[games + 1], char paths[]
+//                                 game paths relative to the folder
+//
+// each section padded to 8 bytes. A lookup is a binary search over the
+// keys and a decode of one short list.
+//
+// update() adds games: they are replayed in parallel and every worker
+// collects (key, game, ply) entries, sorting and spilling them to a run
+// file whenever its buffer is full. The runs, the workers' last buffers
+// and the postings of the previous index are then merged in one pass into
+// a new file that replaces the old. New games get numbers after the old
+// ones, so old postings keep their order and are copied ahead of the new.
+
+class PositionIndex {
+public:
+    struct Posting {
+        uint32_t game;
+        uint16_t ply;
+    };
+
+    // The postings of one key, decoded while iterating
+    class Postings {
+    public:
+        class iterator {
+        public:
+            iterator(const uint8_t* p, const uint8_t* end) : p_(p), end_(end) { load(); }
+            Posting operator*() const { return cur_; }
+            iterator& operator++() {
+                load();
+                return *this;
+            }
+            bool operator!=(const iterator& o) const { return p_ != o.p_ || done_ != o.done_; }
+
+        private:
+            void load() {
+                if (p_ == end_) {
+                    done_ = true;
+                    return;
+                }
+                uint64_t delta = varint(p_), ply = varint(p_);
+                cur_.ply = static_cast<uint16_t>(delta == 0 && !first_ ? cur_.ply + ply : ply);
+                cur_.game += static_cast<uint32_t>(delta);
+                first_ = false;
+            }
+
+            const uint8_t* p_;
+            const uint8_t* end_;
+            Posting cur_{0, 0};
+            bool first_ = true;
+            bool done_ = false;
+        };
+
+        Postings() = default;
+        Postings(const uint8_t* begin, const uint8_t* end) : begin_(begin), end_(end) {}
+        iterator begin() const { return iterator(begin_, end_); }
+        iterator end() const { return iterator(end_, end_); }
+        bool empty() const { return begin_ == end_; }
+
+    private:
+        const uint8_t* begin_ = nullptr;
+        const uint8_t* end_ = nullptr;
+    };
+
+    struct UpdateStats {
+        size_t added = 0;      // games replayed into the index
+        size_t entries = 0;    // their positions
+        size_t runs = 0;       // sorted runs spilled to disk
+        std::vector<std::string> errors;  // games that could not be replayed
+    };
+
+    // Entries a worker sorts in memory before spilling a run (16 bytes each)
+    static constexpr size_t RUN_ENTRIES = 1 << 22;
+
+    PositionIndex() = default;
+    PositionIndex(const PositionIndex&) = delete;
+    PositionIndex& operator=(const PositionIndex&) = delete;
+    ~PositionIndex() { unmap(); }
+
+    // Location of the index file for a folder
+    static std::filesystem::path pathFor(const std::filesystem::path& folder) {
+        std::filesystem::path abs = std::filesystem::absolute(folder).lexically_normal();
+        if (!abs.has_filename()) abs = abs.parent_path();
+        return abs.parent_path() / ("." + abs.filename().string() + ".kifpos");
+    }
+
+    // Map the index of `folder` for lookups
+    bool open(const std::filesystem::path& folder, std::string& error) {
+        std::filesystem::path file = pathFor(folder);
+        if (!map(file)) {
+            error = "no position index at " + file.string();
+            return false;
+        }
+        return true;
+    }
+
+    // Add the games at `paths` (relative to `folder`) that the index does
+    // not have yet, creating the index if needed, and map the result. An
+    // existing index that cannot be mapped is an error: rebuilding it from
+    // `paths` alone would drop every game not listed there.
+    bool update(const std::filesystem::path& folder, const std::vector<std::string>& paths, unsigned threads,
+                UpdateStats& stats, std::string& error, size_t runEntries = RUN_ENTRIES) {
+        std::filesystem::path file = pathFor(folder);
+        stats = UpdateStats();
+        if (!map(file) && ::access(file.c_str(), F_OK) == 0) {
+            error = file.string() + " is damaged; rebuild it with analyze_kif --index";
+            return false;
+        }
+        std::unordered_set<std::string_view> known;
+        for (uint32_t g = 0; g < games(); ++g) known.insert(path(g));
+        std::vector<std::string> fresh;
+        for (const auto& p : paths) {
+            if (known.insert(p).second) fresh.push_back(p);
+        }
+        if (fresh.empty() && valid()) return true;
+
+        // Replay in parallel; entries carry the index into `fresh` for now
+        std::vector<Worker> workers(std::max(1u, threads));
+        std::vector<char> replayed(fresh.size(), 0);
+        std::vector<std::string> errors(fresh.size());
+        std::atomic<size_t> runNumber{0};
+        parallelForWorkers(fresh.size(), static_cast<unsigned>(workers.size()), [&](unsigned t, size_t i) {
+            Worker& w = workers[t];
+            if (!w.file.open(folder / fresh[i], errors[i]) || !kif::parse(w.file.data(), w.record, errors[i]) ||
+                !shogi::replay(w.record, w.pos, w.moves, w.keys, errors[i])) {
+                return;
+            }
+            replayed[i] = 1;
+            w.added += w.keys.size();
+            for (size_t k = 0; k < w.keys.size() && k <= UINT16_MAX; ++k) {
+                w.entries.push_back({w.keys[k], static_cast<uint32_t>(i), static_cast<uint16_t>(k), 0});
+            }
+            if (w.entries.size() >= runEntries && w.error.empty()) {
+                std::string run = file.string() + ".run" + std::to_string(runNumber++);
+                w.runs.push_back(run);
+                spill(w.entries, run, w.error);
+            }
+        });
+
+        // Final game numbers: after the old games, in the order of `paths`
+        std::vector<uint32_t> ids(fresh.size(), UINT32_MAX);
+        uint32_t next = static_cast<uint32_t>(games());
+        std::vector<std::string_view> newPaths;
+        for (size_t i = 0; i < fresh.size(); ++i) {
+            if (!replayed[i]) {
+                stats.errors.push_back(fresh[i] + ": " + errors[i]);
+                continue;
+            }
+            ids[i] = next++;
+            newPaths.push_back(fresh[i]);
+        }
+        std::vector<std::string> runs;
+        for (Worker& w : workers) {
+            if (error.empty() && !w.error.empty()) error = w.error;
+            std::sort(w.entries.begin(), w.entries.end());
+            runs.insert(runs.end(), w.runs.begin(), w.runs.end());
+            stats.entries += w.added;
+        }
+        stats.runs = runs.size();
+        stats.added = newPaths.size();
+
+        bool ok = error.empty() && merge(workers, runs, ids, newPaths, file, error);
+        for (const auto& run : runs) ::unlink(run.c_str());
+        if (!ok) return false;
+        unmap();
+        if (!map(file)) {
+            error = "cannot map " + file.string();
+            return false;
+        }
+        return true;
+    }
+
+    // Replace the paths of games that were moved (old → new, relative to
+    // `folder`), keeping everything else of the index
+    static bool renamePaths(const std::filesystem::path& folder, const std::map<std::string, std::string>& renamed,
+                            std::string& error) {
+        PositionIndex index;
+        std::filesystem::path file = pathFor(folder);
+        if (!index.map(file)) {
+            error = "no position index at " + file.string();
+            return false;
+        }
+        std::vector<std::string_view> paths;
+        for (uint32_t g = 0; g < index.games(); ++g) {
+            auto it = renamed.find(std::string(index.path(g)));
+            paths.push_back(it == renamed.end() ? index.path(g) : std::string_view(it->second));
+        }
+        Writer out;
+        if (!out.open(file, error)) return false;
+        const Header& h = *index.header();
+        uint64_t at[SECTIONS + 1];
+        offsets(h, at);
+        out.put(index.base_ + sizeof(Header), at[PATH_OFFSET] - sizeof(Header));
+        return out.finish(h.keys, h.postingBytes, paths, file, error);
+    }
+
+    // Drop the games at `removed` (relative to `folder`) with their
+    // postings; the remaining games keep their order and are renumbered
+    static bool removePaths(const std::filesystem::path& folder, const std::unordered_set<std::string>& removed,
+                            std::string& error) {
+        PositionIndex index;
+        std::filesystem::path file = pathFor(folder);
+        if (!index.map(file)) {
+            error = "no position index at " + file.string();
+            return false;
+        }
+        std::vector<uint32_t> ids(index.games(), UINT32_MAX);
+        std::vector<std::string_view> paths;
+        for (uint32_t g = 0; g < index.games(); ++g) {
+            if (removed.count(std::string(index.path(g)))) continue;
+            ids[g] = static_cast<uint32_t>(paths.size());
+            paths.push_back(index.path(g));
+        }
+        if (paths.size() == index.games()) return true;
+
+        Writer out;
+        if (!out.open(file, error)) return false;
+        const uint64_t* keys = index.section<uint64_t>(KEYS);
+        const uint32_t* off = index.section<uint32_t>(POSTING_OFFSET);
+        const uint8_t* base = index.section<uint8_t>(POSTINGS);
+        std::vector<uint64_t> kept;
+        std::vector<uint32_t> postingOffset{0};
+        std::string chunk;
+        uint64_t postingBytes = 0;
+        for (size_t k = 0; k < index.keys(); ++k) {
+            Posting last{0, 0};
+            bool any = false;
+            for (Posting p : Postings(base + off[k], base + off[k + 1])) {
+                uint32_t g = ids[p.game];
+                if (g == UINT32_MAX) continue;
+                putVarint(chunk, any ? g - last.game : g);
+                putVarint(chunk, any && g == last.game ? p.ply - last.ply : p.ply);
+                last = {g, p.ply};
+                any = true;
+            }
+            if (!any) continue;
+            kept.push_back(keys[k]);
+            postingOffset.push_back(static_cast<uint32_t>(postingBytes + chunk.size()));
+            if (chunk.size() >= (1 << 16)) {
+                out.put(chunk.data(), chunk.size());
+                postingBytes += chunk.size();
+                chunk.clear();
+            }
+        }
+        out.put(chunk.data(), chunk.size());
+        postingBytes += chunk.size();
+        out.pad();
+        out.put(kept.data(), kept.size() * 8);
+        out.pad();
+        out.put(postingOffset.data(), postingOffset.size() * 4);
+        out.pad();
+        return out.finish(kept.size(), postingBytes, paths, file, error);
+    }
+
+    size_t keys() const { return valid() ? header()->keys : 0; }
+    size_t games() const { return valid() ? header()->games : 0; }
+    size_t bytes() const { return size_; }
+
+    // Where the position with this key occurred, in game order
+    Postings find(uint64_t key) const {
+        if (!valid()) return {};
+        const uint64_t* first = section<uint64_t>(KEYS);
+        const uint64_t* last = first + header()->keys;
+        const uint64_t* it = std::lower_bound(first, last, key);
+        if (it == last || *it != key) return {};
+        const uint32_t* off = section<uint32_t>(POSTING_OFFSET);
+        const uint8_t* postings = section<uint8_t>(POSTINGS);
+        size_t k = static_cast<size_t>(it - first);
+        return {postings + off[k], postings + off[k + 1]};
+    }
+
+    std::string_view path(uint32_t game) const {
+        const uint32_t* off = section<uint32_t>(PATH_OFFSET);
+        return {section<char>(PATHS) + off[game], off[game + 1] - off[game]};
+    }
+
+private:
+    static constexpr char MAGIC[8] = {'K', 'I', 'F', 'P', 'O', 'S', '0', '1'};
+
+    struct Header {
+        char magic[8];
+        uint64_t keys;
+        uint64_t games;
+        uint64_t postingBytes;
+        uint64_t pathBytes;
+        uint64_t reserved[3];
+    };
+
+    enum Section { POSTINGS, KEYS, POSTING_OFFSET, PATH_OFFSET, PATHS, SECTIONS };
+
+    struct Entry {
+        uint64_t key;
+        uint32_t game;
+        uint16_t ply;
+        uint16_t reserved;
+
+        bool operator<(const Entry& o) const {
+            if (key != o.key) return key < o.key;
+            if (game != o.game) return game < o.game;
+            return ply < o.ply;
+        }
+    };
+
+    // Per-thread state of update(), reused from one game to the next
+    struct Worker {
+        kif::KifFile file;
+        kif::Record record;
+        shogi::Position pos;
+        std::vector<shogi::Move> moves;
+        std::vector<uint64_t> keys;
+        std::vector<Entry> entries;
+        std::vector<std::string> runs;
+        size_t added = 0;  // entries collected, spilled ones included
+        std::string error;
+    };
+
+    // Sequential output through a temporary file; the header goes in last
+    struct Writer {
+        int fd = -1;
+        uint64_t written = 0;
+        std::string tmp;
+        bool ok = true;
+
+        bool open(const std::filesystem::path& file, std::string& error) {
+            tmp = file.string() + ".tmp";
+            fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                error = "cannot create " + tmp + ": " + std::strerror(errno);
+                return false;
+            }
+            Header h{};
+            put(&h, sizeof(h));
+            return true;
+        }
+
+        void put(const void* data, size_t len) {
+            const char* p = static_cast<const char*>(data);
+            written += len;
+            while (ok && len > 0) {
+                ssize_t n = ::write(fd, p, len);
+                if (n <= 0) ok = false;
+                else {
+                    p += n;
+                    len -= static_cast<size_t>(n);
+                }
+            }
+        }
+
+        void pad() {
+            static const char zeros[8] = {};
+            put(zeros, (8 - written % 8) % 8);
+        }
+
+        // Write the path table and the header, then replace `file`
+        bool finish(uint64_t keys, uint64_t postingBytes, const std::vector<std::string_view>& paths,
+                    const std::filesystem::path& file, std::string& error) {
+            std::vector<uint32_t> pathOffset{0};
+            uint64_t pathBytes = 0;
+            for (auto p : paths) {
+                pathBytes += p.size();
+                pathOffset.push_back(static_cast<uint32_t>(pathBytes));
+            }
+            put(pathOffset.data(), pathOffset.size() * 4);
+            pad();
+            for (auto p : paths) put(p.data(), p.size());
+            pad();
+            Header h{};
+            std::memcpy(h.magic, MAGIC, sizeof(MAGIC));
+            h.keys = keys;
+            h.games = paths.size();
+            h.postingBytes = postingBytes;
+            h.pathBytes = pathBytes;
+            ok = ok && ::pwrite(fd, &h, sizeof(h), 0) == static_cast<ssize_t>(sizeof(h));
+            ok = ::close(fd) == 0 && ok;
+            if (!ok || pathBytes > UINT32_MAX || ::rename(tmp.c_str(), file.c_str()) != 0) {
+                error = "cannot write " + file.string() + ": " + std::strerror(errno);
+                ::unlink(tmp.c_str());
+                return false;
+            }
+            return true;
+        }
+    };
+
+    static uint64_t varint(const uint8_t*& p) {
+        uint64_t v = 0;
+        for (int shift = 0;; shift += 7) {
+            uint8_t b = *p++;
+            v |= static_cast<uint64_t>(b & 0x7F) << shift;
+            if (!(b & 0x80)) return v;
+        }
+    }
+
+    static void putVarint(std::string& out, uint64_t v) {
+        while (v >= 0x80) {
+            out += static_cast<char>(v | 0x80);
+            v >>= 7;
+        }
+        out += static_cast<char>(v);
+    }
+
+    // Sort `entries` into a run file and empty the buffer
+    static void spill(std::vector<Entry>& entries, const std::string& run, std::string& error) {
+        std::sort(entries.begin(), entries.end());
+        int fd = ::open(run.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        const char* p = reinterpret_cast<const char*>(entries.data());
+        size_t len = entries.size() * sizeof(Entry);
+        while (fd >= 0 && len > 0) {
+            ssize_t n = ::write(fd, p, len);
+            if (n <= 0) break;
+            p += n;
+            len -= static_cast<size_t>(n);
+        }
+        if (fd < 0 || len > 0) error = "cannot write " + run + ": " + std::strerror(errno);
+        if (fd >= 0) ::close(fd);
+        entries.clear();
+    }
+
+    // Merge the old postings, the run files and the workers' sorted buffers
+    // into a new index file
+    bool merge(const std::vector<Worker>& workers, const std::vector<std::string>& runs,
+               const std::vector<uint32_t>& ids, const std::vector<std::string_view>& newPaths,
+               const std::filesystem::path& file, std::string& error) {
+        // Each source yields entries in order; new ones are renumbered
+        std::vector<std::function<bool(Entry&)>> sources;
+        if (valid()) {
+            size_t k = 0, total = header()->keys;
+            const uint64_t* keys = section<uint64_t>(KEYS);
+            const uint32_t* off = section<uint32_t>(POSTING_OFFSET);
+            const uint8_t* base = section<uint8_t>(POSTINGS);
+            Postings::iterator it(base, base), end(base, base);
+            sources.push_back([=](Entry& e) mutable {
+                while (!(it != end)) {
+                    if (k == total) return false;
+                    it = Postings::iterator(base + off[k], base + off[k + 1]);
+                    end = Postings::iterator(base + off[k + 1], base + off[k + 1]);
+                    ++k;
+                }
+                Posting p = *it;
+                ++it;
+                e = {keys[k - 1], p.game, p.ply, 0};
+                return true;
+            });
+        }
+        std::vector<int> fds;
+        for (const auto& run : runs) {
+            int fd = ::open(run.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                error = "cannot open " + run + ": " + std::strerror(errno);
+                for (int f : fds) ::close(f);
+                return false;
+            }
+            fds.push_back(fd);
+            auto buffer = std::make_shared<std::vector<Entry>>();
+            size_t pos = 0;
+            sources.push_back([fd, buffer, pos, &ids](Entry& e) mutable {
+                if (pos == buffer->size()) {
+                    buffer->resize(1 << 16);
+                    ssize_t n = ::read(fd, buffer->data(), buffer->size() * sizeof(Entry));
+                    buffer->resize(n > 0 ? static_cast<size_t>(n) / sizeof(Entry) : 0);
+                    pos = 0;
+                    if (buffer->empty()) return false;
+                }
+                e = (*buffer)[pos++];
+                e.game = ids[e.game];
+                return true;
+            });
+        }
+        for (const Worker& w : workers) {
+            size_t pos = 0;
+            const std::vector<Entry>* entries = &w.entries;
+            sources.push_back([pos, entries, &ids](Entry& e) mutable {
+                if (pos == entries->size()) return false;
+                e = (*entries)[pos++];
+                e.game = ids[e.game];
+                return true;
+            });
+        }
+
+        using Head = std::pair<Entry, size_t>;
+        auto later = [](const Head& a, const Head& b) { return b.first < a.first; };
+        std::priority_queue<Head, std::vector<Head>, decltype(later)> heads(later);
+        for (size_t s = 0; s < sources.size(); ++s) {
+            Entry e;
+            if (sources[s](e)) heads.push({e, s});
+        }
+
+        Writer out;
+        if (!out.open(file, error)) {
+            for (int f : fds) ::close(f);
+            return false;
+        }
+        std::vector<uint64_t> keys;
+        std::vector<uint32_t> postingOffset{0};
+        std::string chunk;
+        uint64_t postingBytes = 0;
+        Entry last{};
+        while (!heads.empty()) {
+            auto [e, s] = heads.top();
+            heads.pop();
+            Entry next;
+            if (sources[s](next)) heads.push({next, s});
+            bool newKey = keys.empty() || e.key != last.key;
+            if (newKey) {
+                if (!keys.empty()) postingOffset.push_back(static_cast<uint32_t>(postingBytes + chunk.size()));
+                keys.push_back(e.key);
+                putVarint(chunk, e.game);
+                putVarint(chunk, e.ply);
+            } else {
+                putVarint(chunk, e.game - last.game);
+                putVarint(chunk, e.game == last.game ? e.ply - last.ply : e.ply);
+            }
+            last = e;
+            if (chunk.size() >= (1 << 16)) {
+                out.put(chunk.data(), chunk.size());
+                postingBytes += chunk.size();
+                chunk.clear();
+            }
+        }
+        for (int f : fds) ::close(f);
+        out.put(chunk.data(), chunk.size());
+        postingBytes += chunk.size();
+        if (!keys.empty()) postingOffset.push_back(static_cast<uint32_t>(postingBytes));
+        out.pad();
+        out.put(keys.data(), keys.size() * 8);
+        out.pad();
+        out.put(postingOffset.data(), postingOffset.size() * 4);
+        out.pad();
+
+        std::vector<std::string_view> paths;
+        for (uint32_t g = 0; g < games(); ++g) paths.push_back(path(g));
+        paths.insert(paths.end(), newPaths.begin(), newPaths.end());
+        if (postingBytes > UINT32_MAX) out.ok = false;
+        return out.finish(keys.size(), postingBytes, paths, file, error);
+    }
+
+    // Byte offset of every section, and the file size at [SECTIONS]
+    static void offsets(const Header& h, uint64_t (&at)[SECTIONS + 1]) {
+        const uint64_t bytes[SECTIONS] = {h.postingBytes, h.keys * 8, (h.keys + 1) * 4,
+                                          (h.games + 1) * 4, h.pathBytes};
+        at[0] = sizeof(Header);
+        for (int k = 0; k < SECTIONS; ++k) at[k + 1] = (at[k] + bytes[k] + 7) / 8 * 8;
+    }
+
+    bool valid() const { return base_ != nullptr; }
+    const Header* header() const { return reinterpret_cast<const Header*>(base_); }
+
+    template <typename T>
+    const T* section(Section s) const {
+        uint64_t at[SECTIONS + 1];
+        offsets(*header(), at);
+        return reinterpret_cast<const T*>(base_ + at[s]);
+    }
+
+    bool map(const std::filesystem::path& file) {
+        unmap();
+        int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(Header)) {
+            void* p = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+            if (p != MAP_FAILED) {
+                base_ = static_cast<const char*>(p);
+                size_ = static_cast<size_t>(st.st_size);
+            }
+        }
+        ::close(fd);
+        if (valid()) {
+            uint64_t at[SECTIONS + 1];
+            offsets(*header(), at);
+            if (std::memcmp(header()->magic, MAGIC, sizeof(MAGIC)) != 0 || at[SECTIONS] != size_) unmap();
+        }
+        return valid();
+    }
+
+    void unmap() {
+        if (base_) ::munmap(const_cast<char*>(base_), size_);
+        base_ = nullptr;
+        size_ = 0;
+    }
+
+    const char* base_ = nullptr;
+    size_t size_ = 0;
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+// Replaces duplicate files by links to an identical original. A reflink
+// (FICLONE) is preferred since the copy stays independent; filesystems
+// without reflinks get a hardlink. The link is created under a temporary
+// name in the duplicate's directory and renamed over the duplicate, so the
+// path never disappears and never shows partial content. Directory
+// descriptors are cached across calls, so callers should feed duplicates
+// sorted by directory.
+class LinkReplacer {
+public:
+    enum class Result { Reflinked, Hardlinked, Failed };
+
+    LinkReplacer() = default;
+    LinkReplacer(const LinkReplacer&) = delete;
+    LinkReplacer& operator=(const LinkReplacer&) = delete;
+    ~LinkReplacer() { closeDir(); }
+
+    Result replace(const std::filesystem::path& original, const std::filesystem::path& duplicate,
+                   std::string& error) {
+        std::filesystem::path dir = duplicate.parent_path();
+        if (dir.empty()) dir = ".";
+        if (dir != dirPath_) {
+            closeDir();
+            dirFd_ = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (dirFd_ < 0) {
+                error = std::string("cannot open directory: ") + std::strerror(errno);
+                return Result::Failed;
+            }
+            dirPath_ = dir;
+        }
+
+        struct stat src, dst;
+        if (::stat(original.c_str(), &src) != 0 || ::stat(duplicate.c_str(), &dst) != 0) {
+            error = std::strerror(errno);
+            return Result::Failed;
+        }
+        std::string name = duplicate.filename().string();
+        std::string tmp = "." + name + ".kiflink-" + std::to_string(::getpid());
+
+        if (src.st_dev == dst.st_dev && reflinkSupported(src.st_dev)) {
+            int result = reflink(original, tmp, dst);
+            if (result == 0) return commit(tmp, name, Result::Reflinked, error);
+            if (result != EOPNOTSUPP && result != EINVAL && result != EXDEV && result != ENOTTY) {
+                error = std::string("reflink failed: ") + std::strerror(result);
+                return Result::Failed;
+            }
+            noReflink_[src.st_dev] = true;
+        }
+        if (::linkat(AT_FDCWD, original.c_str(), dirFd_, tmp.c_str(), 0) != 0) {
+            error = std::string("hardlink failed: ") + std::strerror(errno);
+            return Result::Failed;
+        }
+        return commit(tmp, name, Result::Hardlinked, error);
+    }
+
+private:
+    bool reflinkSupported(dev_t dev) const {
+        auto it = noReflink_.find(dev);
+        return it == noReflink_.end() || !it->second;
+    }
+
+    // Clone `original` into `tmp`, keeping the duplicate's mode and times;
+    // returns 0 or an errno value
+    int reflink(const std::filesystem::path& original, const std::string& tmp, const struct stat& dst) {
+        int in = ::open(original.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in < 0) return errno;
+        int out = ::openat(dirFd_, tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, dst.st_mode & 07777);
+        if (out < 0) {
+            int err = errno;
+            ::close(in);
+            return err;
+        }
+        int err = ::ioctl(out, FICLONE, in) == 0 ? 0 : errno;
+        if (err == 0) {
+            struct timespec times[2] = {dst.st_atim, dst.st_mtim};
+            ::fchmod(out, dst.st_mode & 07777);
+            ::futimens(out, times);
+        }
+        ::close(in);
+        ::close(out);
+        if (err != 0) ::unlinkat(dirFd_, tmp.c_str(), 0);
+        return err;
+    }
+
+    Result commit(const std::string& tmp, const std::string& name, Result result, std::string& error) {
+        if (::renameat2(dirFd_, tmp.c_str(), dirFd_, name.c_str(), 0) != 0) {
+            error = std::string("rename failed: ") + std::strerror(errno);
+            ::unlinkat(dirFd_, tmp.c_str(), 0);
+            return Result::Failed;
+        }
+        return result;
+    }
+
+    void closeDir() {
+        if (dirFd_ >= 0) ::close(dirFd_);
+        dirFd_ = -1;
+        dirPath_.clear();
+    }
+
+    int dirFd_ = -1;
+    std::filesystem::path dirPath_;
+    std::map<dev_t, bool> noReflink_;
+};
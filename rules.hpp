@@ -0,0 +1,280 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <regex>
+#include <optional>
+#include <stdexcept>
+#include <cctype>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include "json.hpp"
+#include "game_header.hpp"
+#include "hash128.hpp"
+
+// Routing rules from setting.json, compiled once. Each pattern is turned
+// into a std::regex at load time, together with the literal prefix and
+// suffix every match must have (e.g. ".kif"), so most non-matching rules
+// are rejected with two string compares before the regex runs. A match
+// yields the rule and its date capture from a single regex_match.
+//
+// A rule with "headers" also matches on game header fields (each regex is
+// searched in the field's value, e.g. {"棋戦": "ウォーズ"}); its "pattern"
+// is then optional. "date_header" takes the date from a field such as
+// 開始日時 or Date instead of the filename, formatted by "date_format"
+// ({yyyy}, {mm}, {dd}; default "{yyyy}{mm}{dd}"). Headers are only read
+// when a header rule is reached for a file. "players_pattern" captures the
+// two participants from the file name when the header does not name them.
+//
+// "layout" is the path of a game's folder below output_path. It may use
+// {date} (the captured or formatted date), {yyyy}, {mm} and {dd} (the game
+// date, from the header when the name lacks a year) and {hash} (two hex
+// digits of a hash of the file name, for a 256-way fan-out). The default
+// "{date}" keeps the flat per-day folders.
+
+struct Rule {
+    std::string name;
+    std::string player;
+    std::string pattern;
+    std::string outputPath;
+    std::regex regex;
+    std::string prefix;  // literal text every match starts with
+    std::string suffix;  // literal text every match ends with
+    bool hasPattern = true;
+    std::vector<std::pair<std::string, std::regex>> headers;
+    std::string dateHeader;
+    std::string dateFormat = "{yyyy}{mm}{dd}";
+    bool hasPlayersPattern = false;
+    std::regex playersRegex;  // captures (sente/white, gote/black) from the file name
+    std::string layout = "{date}";
+
+    bool needsHeader() const { return !headers.empty() || !dateHeader.empty(); }
+};
+
+struct RuleMatch {
+    const Rule* rule;
+    std::string date;  // first capture group
+};
+
+class RuleMatcher {
+public:
+    explicit RuleMatcher(const nlohmann::json& settings) {
+        for (const auto& entry : settings) {
+            Rule rule;
+            rule.name = entry.value("name", "");
+            rule.player = entry.value("player", "");
+            rule.outputPath = entry.at("output_path").get<std::string>();
+            nlohmann::json headers = entry.value("headers", nlohmann::json::object());
+            for (const auto& [field, value] : headers.items()) {
+                rule.headers.emplace_back(field, compile(value.get<std::string>(), rule.name));
+            }
+            rule.dateHeader = entry.value("date_header", "");
+            rule.dateFormat = entry.value("date_format", rule.dateFormat);
+            rule.hasPlayersPattern = entry.contains("players_pattern");
+            if (rule.hasPlayersPattern) {
+                rule.playersRegex = compile(entry["players_pattern"].get<std::string>(), rule.name);
+            }
+            rule.layout = entry.value("layout", rule.layout);
+            checkLayout(rule);
+            rule.hasPattern = entry.contains("pattern") || !rule.needsHeader();
+            if (rule.hasPattern) {
+                rule.pattern = entry.at("pattern").get<std::string>();
+                rule.regex = compile(rule.pattern, rule.name);
+                literalAffixes(rule.pattern, rule.prefix, rule.suffix);
+            }
+            rules_.push_back(std::move(rule));
+        }
+    }
+
+    const std::vector<Rule>& rules() const { return rules_; }
+
+    // Folder of a game below the rule's output_path; false if the layout
+    // needs a date part that is unknown (ymd is yyyymmdd or 0)
+    static bool layoutPath(const Rule& rule, const std::string& date, uint32_t ymd, const std::string& name,
+                           std::string& out) {
+        bool needsYmd = rule.layout.find("{yyyy}") != std::string::npos ||
+                        rule.layout.find("{mm}") != std::string::npos ||
+                        rule.layout.find("{dd}") != std::string::npos;
+        if (needsYmd && ymd == 0) return false;
+        if (rule.layout.find("{date}") != std::string::npos && date.empty()) return false;
+        char ymdText[9];
+        std::snprintf(ymdText, sizeof(ymdText), "%08u", ymd % 100000000u);
+        std::string ymdStr(ymdText);
+        out = rule.layout;
+        substitute(out, "{date}", date);
+        substitute(out, "{yyyy}", ymdStr.substr(0, 4));
+        substitute(out, "{mm}", ymdStr.substr(4, 2));
+        substitute(out, "{dd}", ymdStr.substr(6, 2));
+        if (out.find("{hash}") != std::string::npos) substitute(out, "{hash}", hash128(name).hex().substr(0, 2));
+        return true;
+    }
+
+    bool needsHeaders() const {
+        for (const Rule& rule : rules_) {
+            if (rule.needsHeader()) return true;
+        }
+        return false;
+    }
+
+    // First rule matching the whole filename, in setting.json order; header
+    // rules never match
+    std::optional<RuleMatch> match(const std::string& filename) const {
+        return match(filename, []() -> const GameHeader* { return nullptr; });
+    }
+
+    // Same, with loadHeader() returning the file's header (or nullptr if it
+    // cannot be read); it is called only once a header rule is reached
+    template <typename LoadHeader>
+    std::optional<RuleMatch> match(const std::string& filename, LoadHeader&& loadHeader) const {
+        std::string_view name(filename);
+        std::smatch m;
+        for (const Rule& rule : rules_) {
+            if (name.size() < rule.prefix.size() + rule.suffix.size()) continue;
+            if (name.compare(0, rule.prefix.size(), rule.prefix) != 0) continue;
+            if (name.compare(name.size() - rule.suffix.size(), rule.suffix.size(), rule.suffix) != 0) continue;
+            if (rule.hasPattern && !std::regex_match(filename, m, rule.regex)) continue;
+            std::string date = rule.hasPattern && m.size() > 1 ? m[1].str() : std::string();
+            if (rule.needsHeader() && !matchHeader(rule, loadHeader(), date)) continue;
+            return RuleMatch{&rule, date};
+        }
+        return std::nullopt;
+    }
+
+private:
+    static std::regex compile(const std::string& pattern, const std::string& ruleName) {
+        try {
+            return std::regex(pattern, std::regex::ECMAScript | std::regex::optimize);
+        } catch (const std::regex_error& e) {
+            throw std::runtime_error("Invalid pattern in rule '" + ruleName + "': " + e.what());
+        }
+    }
+
+    static bool matchHeader(const Rule& rule, const GameHeader* header, std::string& date) {
+        if (!header) return false;
+        for (const auto& [field, regex] : rule.headers) {
+            const std::string* value = header->find(field);
+            if (!value || !std::regex_search(*value, regex)) return false;
+        }
+        if (rule.dateHeader.empty()) return true;
+        const std::string* value = header->find(rule.dateHeader);
+        return value && formatDate(*value, rule.dateFormat, date);
+    }
+
+    // Fill {yyyy}, {mm} and {dd} from the first three numbers of a header
+    // date such as "2025/06/13 01:38:56" or "2025.08.09"
+    static bool formatDate(const std::string& value, const std::string& format, std::string& out) {
+        std::vector<std::string> parts;
+        for (size_t i = 0; i < value.size() && parts.size() < 3;) {
+            if (!std::isdigit(static_cast<unsigned char>(value[i]))) {
+                ++i;
+                continue;
+            }
+            size_t j = i;
+            while (j < value.size() && std::isdigit(static_cast<unsigned char>(value[j]))) ++j;
+            parts.push_back(value.substr(i, j - i));
+            i = j;
+        }
+        if (parts.size() < 3 || parts[0].size() != 4 || parts[1].size() > 2 || parts[2].size() > 2) return false;
+        for (size_t k = 1; k < 3; ++k) {
+            if (parts[k].size() == 1) parts[k] = "0" + parts[k];
+        }
+        out = format;
+        substitute(out, "{yyyy}", parts[0]);
+        substitute(out, "{mm}", parts[1]);
+        substitute(out, "{dd}", parts[2]);
+        return true;
+    }
+
+    static void substitute(std::string& text, const std::string& key, const std::string& value) {
+        for (size_t at = text.find(key); at != std::string::npos; at = text.find(key, at + value.size())) {
+            text.replace(at, key.size(), value);
+        }
+    }
+
+    static void checkLayout(const Rule& rule) {
+        static const char* const known[] = {"{date}", "{yyyy}", "{mm}", "{dd}", "{hash}"};
+        for (size_t open = rule.layout.find('{'); open != std::string::npos; open = rule.layout.find('{', open + 1)) {
+            size_t close = rule.layout.find('}', open);
+            std::string key = rule.layout.substr(open, close == std::string::npos ? close : close - open + 1);
+            if (std::find(std::begin(known), std::end(known), key) == std::end(known)) {
+                throw std::runtime_error("Unknown placeholder " + key + " in layout of rule '" + rule.name + "'");
+            }
+        }
+        if (rule.layout.empty() || rule.layout.front() == '/' || rule.layout.find("..") != std::string::npos) {
+            throw std::runtime_error("Invalid layout in rule '" + rule.name + "'");
+        }
+    }
+
+    struct Atom {
+        bool literal;
+        char ch;
+        bool quantified;
+    };
+
+    // Split a pattern into atoms (a literal character, an escape, a class
+    // or a group) and record whether each one is followed by a quantifier
+    static bool tokenize(const std::string& p, std::vector<Atom>& atoms) {
+        size_t i = 0;
+        if (i < p.size() && p[i] == '^') ++i;
+        size_t end = p.size();
+        if (end > i && p[end - 1] == '$' && (end < 2 || p[end - 2] != '\\')) --end;
+        while (i < end) {
+            Atom atom{false, 0, false};
+            char c = p[i];
+            if (c == '|') return false;  // alternation: no common affixes
+            if (c == '\\' && i + 1 < end) {
+                char e = p[i + 1];
+                atom.literal = !std::isalnum(static_cast<unsigned char>(e));
+                atom.ch = e;
+                i += 2;
+            } else if (c == '[') {
+                size_t j = i + 1;
+                if (j < end && p[j] == '^') ++j;
+                if (j < end && p[j] == ']') ++j;
+                while (j < end && p[j] != ']') j += p[j] == '\\' ? 2 : 1;
+                i = j + 1;
+            } else if (c == '(') {
+                int depth = 0;
+                size_t j = i;
+                for (; j < end; ++j) {
+                    if (p[j] == '\\') { ++j; continue; }
+                    if (p[j] == '(') ++depth;
+                    if (p[j] == ')' && --depth == 0) break;
+                }
+                i = j + 1;
+            } else {
+                atom.literal = std::string_view(".^$*+?{}()[]|").find(c) == std::string_view::npos;
+                atom.ch = c;
+                ++i;
+            }
+            if (i < end && (p[i] == '*' || p[i] == '+' || p[i] == '?' || p[i] == '{')) {
+                atom.quantified = true;
+                if (p[i] == '{') {
+                    while (i < end && p[i] != '}') ++i;
+                }
+                ++i;
+                if (i < end && p[i] == '?') ++i;  // lazy quantifier
+            }
+            atoms.push_back(atom);
+        }
+        return true;
+    }
+
+    static void literalAffixes(const std::string& pattern, std::string& prefix, std::string& suffix) {
+        std::vector<Atom> atoms;
+        if (!tokenize(pattern, atoms)) return;
+        size_t head = 0;
+        while (head < atoms.size() && atoms[head].literal && !atoms[head].quantified) {
+            prefix += atoms[head++].ch;
+        }
+        size_t tail = atoms.size();
+        while (tail > head && atoms[tail - 1].literal && !atoms[tail - 1].quantified) --tail;
+        for (size_t k = tail; k < atoms.size(); ++k) suffix += atoms[k].ch;
+    }
+
+    std::vector<Rule> rules_;
+};
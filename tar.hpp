@@ -0,0 +1,260 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+
+// Forward-only reader for POSIX ustar archives, including the GNU long
+// name ('L') and pax ('x') extensions that tar uses for paths over 100
+// bytes. The archive is consumed with large sequential read() calls and
+// never seeks, so it also works on pipes. Member data is read straight into
+// the caller's buffer once the 1 MiB staging buffer is drained.
+
+struct TarEntry {
+    std::string path;
+    char type = '0';      // '0' regular file, '5' directory, ...
+    uint64_t size = 0;
+    uint32_t mode = 0644;
+    int64_t mtime = 0;
+
+    bool regular() const { return type == '0' || type == '\0' || type == '7'; }
+};
+
+namespace tar {
+
+constexpr size_t BLOCK = 512;
+
+// Long names and pax headers above this size are treated as corruption
+constexpr uint64_t MAX_EXTENSION_BYTES = 256 << 10;
+
+inline uint64_t padded(uint64_t size) { return (size + BLOCK - 1) / BLOCK * BLOCK; }
+
+// Numeric header field: octal text, or GNU base-256 when the top bit is set
+inline uint64_t number(const char* field, size_t len) {
+    uint64_t value = 0;
+    if (static_cast<unsigned char>(field[0]) & 0x80) {
+        value = static_cast<unsigned char>(field[0]) & 0x7F;
+        for (size_t i = 1; i < len; ++i) value = (value << 8) | static_cast<unsigned char>(field[i]);
+        return value;
+    }
+    size_t i = 0;
+    while (i < len && field[i] == ' ') ++i;
+    for (; i < len && field[i] >= '0' && field[i] <= '7'; ++i) value = value * 8 + static_cast<uint64_t>(field[i] - '0');
+    return value;
+}
+
+inline std::string text(const char* field, size_t len) {
+    return std::string(field, strnlen(field, len));
+}
+
+// Header checksum: the byte sum with the checksum field read as spaces
+inline bool checksumValid(const char* block) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < BLOCK; ++i) {
+        sum += (i >= 148 && i < 156) ? ' ' : static_cast<unsigned char>(block[i]);
+    }
+    return sum == number(block + 148, 8);
+}
+
+// Parse a decimal pax field; false if it is empty, not all digits or
+// does not fit in 64 bits
+inline bool decimal(std::string_view digits, uint64_t& value) {
+    if (digits.empty() || digits.size() > 19) return false;
+    value = 0;
+    for (char c : digits) {
+        if (c < '0' || c > '9') return false;
+        value = value * 10 + static_cast<uint64_t>(c - '0');
+    }
+    return true;
+}
+
+// Apply the "path" and "size" records of a pax header ("len key=value\n").
+// Parsing stops at the first malformed record; a bad size is ignored.
+inline void applyPax(std::string_view data, TarEntry& entry, bool& hasPath, bool& hasSize) {
+    while (!data.empty()) {
+        size_t space = data.find(' ');
+        if (space == std::string_view::npos) return;
+        uint64_t len = 0;
+        if (!decimal(data.substr(0, space), len)) return;
+        if (len <= space + 1 || len > data.size()) return;
+        std::string_view record = data.substr(space + 1, len - space - 2);  // without the newline
+        size_t eq = record.find('=');
+        if (eq != std::string_view::npos) {
+            std::string_view key = record.substr(0, eq), value = record.substr(eq + 1);
+            if (key == "path") {
+                entry.path = std::string(value);
+                hasPath = true;
+            } else if (key == "size") {
+                uint64_t size = 0;
+                if (decimal(value, size)) {
+                    entry.size = size;
+                    hasSize = true;
+                }
+            }
+        }
+        data.remove_prefix(len);
+    }
+}
+
+}  // namespace tar
+
+class TarReader {
+public:
+    static constexpr size_t BUFFER_BYTES = 1 << 20;
+
+    explicit TarReader(int fd) : fd_(fd), buf_(BUFFER_BYTES, '\0') {}
+
+    // Advance to the next file, directory or link. Returns false at the end
+    // of the archive, or with `error` set if it is truncated or corrupt.
+    // Unread data of the previous entry is skipped.
+    bool next(TarEntry& entry, std::string& error) {
+        error.clear();
+        if (!skip(error)) return false;
+        std::string longName;
+        TarEntry pax;
+        bool paxPath = false, paxSize = false;
+        while (true) {
+            char block[tar::BLOCK];
+            size_t got = 0;
+            if (!readExact(block, tar::BLOCK, got, error)) return false;
+            if (got == 0) return false;  // archive without end blocks
+            if (got < tar::BLOCK) {
+                error = "truncated tar header";
+                return false;
+            }
+            if (std::all_of(block, block + tar::BLOCK, [](char c) { return c == 0; })) return false;
+            if (!tar::checksumValid(block)) {
+                error = "bad tar header checksum";
+                return false;
+            }
+
+            entry = TarEntry();
+            entry.type = block[156];
+            entry.size = tar::number(block + 124, 12);
+            entry.mode = static_cast<uint32_t>(tar::number(block + 100, 8));
+            entry.mtime = static_cast<int64_t>(tar::number(block + 136, 12));
+            remaining_ = entry.size;
+            padding_ = tar::padded(entry.size) - entry.size;
+
+            if (entry.type == 'L' || entry.type == 'x') {
+                if (entry.size > tar::MAX_EXTENSION_BYTES) {
+                    error = "oversized tar extended header";
+                    return false;
+                }
+                std::string data;
+                if (!read(data, error)) return false;
+                if (entry.type == 'L') {
+                    longName.assign(data.c_str());
+                } else {
+                    tar::applyPax(data, pax, paxPath, paxSize);
+                }
+                if (!skip(error)) return false;
+                continue;
+            }
+            if (entry.type == 'g') {
+                if (!skip(error)) return false;
+                continue;
+            }
+
+            if (paxPath) {
+                entry.path = pax.path;
+            } else if (!longName.empty()) {
+                entry.path = longName;
+            } else {
+                std::string prefix = std::memcmp(block + 257, "ustar", 5) == 0 ? tar::text(block + 345, 155) : "";
+                entry.path = tar::text(block, 100);
+                if (!prefix.empty()) entry.path = prefix + "/" + entry.path;
+            }
+            if (paxSize) {
+                entry.size = pax.size;
+                remaining_ = entry.size;
+                padding_ = tar::padded(entry.size) - entry.size;
+            }
+            return true;
+        }
+    }
+
+    // Read the rest of the current entry's data into `data`
+    bool read(std::string& data, std::string& error) {
+        data.resize(static_cast<size_t>(remaining_));
+        size_t got = 0;
+        if (!readExact(&data[0], data.size(), got, error)) return false;
+        if (got < data.size()) {
+            error = "truncated tar member";
+            return false;
+        }
+        remaining_ = 0;
+        return true;
+    }
+
+    // Discard the rest of the current entry and its padding
+    bool skip(std::string& error) {
+        uint64_t count = remaining_ + padding_;
+        remaining_ = padding_ = 0;
+        while (count > 0) {
+            if (pos_ == end_ && !fill(error)) return false;
+            if (pos_ == end_) {
+                error = "truncated tar member";
+                return false;
+            }
+            size_t step = static_cast<size_t>(std::min<uint64_t>(count, end_ - pos_));
+            pos_ += step;
+            count -= step;
+        }
+        return true;
+    }
+
+private:
+    // Copy `len` bytes to `out`, first from the staging buffer, then with
+    // read() directly into `out` for large requests. `got` < len at EOF.
+    bool readExact(char* out, size_t len, size_t& got, std::string& error) {
+        got = std::min(len, end_ - pos_);
+        std::memcpy(out, buf_.data() + pos_, got);
+        pos_ += got;
+        while (got < len) {
+            if (len - got >= BUFFER_BYTES / 2) {
+                ssize_t n = ::read(fd_, out + got, len - got);
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0) {
+                    error = std::string("read failed: ") + std::strerror(errno);
+                    return false;
+                }
+                if (n == 0) return true;
+                got += static_cast<size_t>(n);
+                continue;
+            }
+            if (!fill(error)) return false;
+            if (pos_ == end_) return true;
+            size_t step = std::min(len - got, end_ - pos_);
+            std::memcpy(out + got, buf_.data() + pos_, step);
+            pos_ += step;
+            got += step;
+        }
+        return true;
+    }
+
+    // Refill the empty staging buffer; leaves it empty at EOF
+    bool fill(std::string& error) {
+        pos_ = end_ = 0;
+        while (true) {
+            ssize_t n = ::read(fd_, &buf_[0], buf_.size());
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                error = std::string("read failed: ") + std::strerror(errno);
+                return false;
+            }
+            end_ = static_cast<size_t>(n);
+            return true;
+        }
+    }
+
+    int fd_;
+    std::string buf_;
+    size_t pos_ = 0, end_ = 0;
+    uint64_t remaining_ = 0;  // unread data of the current entry
+    uint64_t padding_ = 0;    // zero bytes after it up to the next block
+};
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <cerrno>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// In-process implementation of the freedesktop.org Trash specification.
+// Files on the home filesystem go to $XDG_DATA_HOME/Trash; files on other
+// mounts go to $topdir/.Trash/$uid or $topdir/.Trash-$uid. Trash
+// directories are resolved once per device and kept open, so trashing a
+// batch costs one .trashinfo write and one no-replace rename per file.
+class Trash {
+public:
+    Trash() = default;
+    Trash(const Trash&) = delete;
+    Trash& operator=(const Trash&) = delete;
+
+    ~Trash() {
+        for (auto& [dev, dir] : dirs_) {
+            if (dir.filesFd >= 0) ::close(dir.filesFd);
+            if (dir.infoFd >= 0) ::close(dir.infoFd);
+        }
+    }
+
+    // Move one file to the trash; on failure `error` describes why
+    bool move(const std::filesystem::path& file, std::string& error) {
+        std::error_code ec;
+        std::filesystem::path abs = std::filesystem::absolute(file, ec).lexically_normal();
+        if (ec) {
+            error = ec.message();
+            return false;
+        }
+        struct stat st;
+        if (::lstat(abs.c_str(), &st) != 0) {
+            error = std::strerror(errno);
+            return false;
+        }
+        const TrashDir* dir = dirFor(abs, st.st_dev, error);
+        if (!dir) return false;
+
+        std::string pathField = abs.string();
+        if (!dir->topdir.empty()) {
+            pathField = abs.lexically_relative(dir->topdir).string();
+        }
+        std::string info = "[Trash Info]\nPath=" + percentEncode(pathField) +
+                           "\nDeletionDate=" + deletionDate() + "\n";
+
+        std::string base = abs.filename().string();
+        for (int n = 1; n < 10000; ++n) {
+            std::string name = n == 1 ? base : base + "." + std::to_string(n);
+            std::string infoName = name + ".trashinfo";
+            int fd = ::openat(dir->infoFd, infoName.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+            if (fd < 0) {
+                if (errno == EEXIST) continue;
+                error = std::string("cannot write trashinfo: ") + std::strerror(errno);
+                return false;
+            }
+            bool written = ::write(fd, info.data(), info.size()) == static_cast<ssize_t>(info.size());
+            ::close(fd);
+            // A file of this name can be in files/ without its .trashinfo
+            // (left by another tool); never replace it
+            if (written && ::renameat2(AT_FDCWD, abs.c_str(), dir->filesFd, name.c_str(), RENAME_NOREPLACE) == 0) {
+                return true;
+            }
+            int saved = errno;
+            ::unlinkat(dir->infoFd, infoName.c_str(), 0);
+            if (written && saved == EEXIST) continue;
+            error = std::strerror(written ? saved : EIO);
+            return false;
+        }
+        error = "too many files with the same name in trash";
+        return false;
+    }
+
+private:
+    struct TrashDir {
+        std::filesystem::path topdir;  // empty for the home trash
+        int filesFd = -1;
+        int infoFd = -1;
+    };
+
+    std::map<dev_t, TrashDir> dirs_;
+    bool homeResolved_ = false;
+    dev_t homeDev_ = 0;
+    std::filesystem::path homeTrash_;
+
+    static std::string percentEncode(const std::string& s) {
+        static const char hex[] = "0123456789ABCDEF";
+        std::string out;
+        for (unsigned char c : s) {
+            if (std::isalnum(c) || std::strchr("/-_.!~*'()", c)) {
+                out += static_cast<char>(c);
+            } else {
+                out += '%';
+                out += hex[c >> 4];
+                out += hex[c & 15];
+            }
+        }
+        return out;
+    }
+
+    static std::string deletionDate() {
+        std::time_t now = std::time(nullptr);
+        std::tm tm;
+        ::localtime_r(&now, &tm);
+        char buf[32];
+        std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+        return buf;
+    }
+
+    static bool makeDir(const std::filesystem::path& p) {
+        return ::mkdir(p.c_str(), 0700) == 0 || errno == EEXIST;
+    }
+
+    // Open files/ and info/ below `root`, creating them as needed
+    static bool openDirs(const std::filesystem::path& root, TrashDir& dir) {
+        if (!makeDir(root) || !makeDir(root / "files") || !makeDir(root / "info")) return false;
+        dir.filesFd = ::open((root / "files").c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        dir.infoFd = ::open((root / "info").c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir.filesFd >= 0 && dir.infoFd >= 0) return true;
+        if (dir.filesFd >= 0) ::close(dir.filesFd);
+        if (dir.infoFd >= 0) ::close(dir.infoFd);
+        dir.filesFd = dir.infoFd = -1;
+        return false;
+    }
+
+    void resolveHome() {
+        homeResolved_ = true;
+        const char* dataHome = std::getenv("XDG_DATA_HOME");
+        const char* home = std::getenv("HOME");
+        if (dataHome && *dataHome) {
+            homeTrash_ = std::filesystem::path(dataHome) / "Trash";
+        } else if (home && *home) {
+            homeTrash_ = std::filesystem::path(home) / ".local/share/Trash";
+        } else {
+            return;
+        }
+        std::error_code ec;
+        std::filesystem::create_directories(homeTrash_, ec);
+        struct stat st;
+        if (::stat(homeTrash_.c_str(), &st) == 0) homeDev_ = st.st_dev;
+        else homeTrash_.clear();
+    }
+
+    // Highest ancestor of `p` that is still on device `dev`
+    static std::filesystem::path mountTop(const std::filesystem::path& p, dev_t dev) {
+        std::filesystem::path top = p.parent_path();
+        while (top.has_parent_path() && top != top.root_path()) {
+            struct stat st;
+            if (::stat(top.parent_path().c_str(), &st) != 0 || st.st_dev != dev) break;
+            top = top.parent_path();
+        }
+        return top;
+    }
+
+    const TrashDir* dirFor(const std::filesystem::path& file, dev_t dev, std::string& error) {
+        auto it = dirs_.find(dev);
+        if (it != dirs_.end()) return &it->second;
+
+        if (!homeResolved_) resolveHome();
+        TrashDir dir;
+        bool ok = false;
+        if (!homeTrash_.empty() && dev == homeDev_) {
+            ok = openDirs(homeTrash_, dir);
+        } else {
+            dir.topdir = mountTop(file, dev);
+            std::string uid = std::to_string(::getuid());
+            struct stat st;
+            std::filesystem::path shared = dir.topdir / ".Trash";
+            // $topdir/.Trash is only usable if it is a real sticky directory
+            if (::lstat(shared.c_str(), &st) == 0 && S_ISDIR(st.st_mode) && (st.st_mode & S_ISVTX)) {
+                ok = openDirs(shared / uid, dir);
+            }
+            if (!ok) ok = openDirs(dir.topdir / (".Trash-" + uid), dir);
+        }
+        if (!ok) {
+            error = std::string("no usable trash directory: ") + std::strerror(errno);
+            return nullptr;
+        }
+        return &dirs_.emplace(dev, dir).first->second;
+    }
+};
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <filesystem>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+// Parallel directory walker built on openat/getdents64. Every worker owns a
+// deque of pending directories: it pops its own work from the back and
+// steals from the front of other workers' deques when it runs dry, so wide
+// trees such as Evaluation/evaluated_kif/YYYYMMDD/ spread over all threads.
+// File types come from d_type; a stat is only issued when the filesystem
+// reports DT_UNKNOWN or the entry is a symlink. Directories that cannot be
+// opened or read are skipped and returned to the caller as errors.
+
+struct WalkEntry {
+    const std::string& dir;  // directory path as reached from the root
+    const char* name;        // file name inside `dir`
+    int dirfd;               // open descriptor of `dir`, valid during the callback
+
+    std::filesystem::path path() const { return std::filesystem::path(dir) / name; }
+};
+
+struct WalkOptions {
+    unsigned threads = 0;  // 0 = hardware concurrency
+    int maxDepth = -1;     // -1 = unlimited, 0 = only the root directory
+};
+
+class Walker {
+public:
+    // Call visit(worker, entry) for every regular file below root. `worker`
+    // is in [0, workers()) and lets callers keep per-thread results without
+    // locking; visit is called concurrently from different workers. Returns
+    // one message per directory that could not be read, the root included.
+    template <typename Visit>
+    static std::vector<std::string> walk(const std::filesystem::path& root, const WalkOptions& options, Visit visit) {
+        unsigned n = options.threads ? options.threads : workers();
+        Walker w(n, options.maxDepth);
+        std::string start = root.string();
+        while (start.size() > 1 && start.back() == '/') start.pop_back();
+        w.queues_[0].tasks.push_back({start, 0});
+        w.pending_ = 1;
+
+        std::vector<std::thread> pool;
+        for (unsigned t = 1; t < n; ++t) {
+            pool.emplace_back([&w, &visit, t]() { w.run(t, visit); });
+        }
+        w.run(0, visit);
+        for (auto& th : pool) th.join();
+        return std::move(w.errors_);
+    }
+
+    static unsigned workers(unsigned requested = 0) {
+        return requested ? requested : std::max(1u, std::thread::hardware_concurrency());
+    }
+
+private:
+    struct Task {
+        std::string path;
+        int depth;
+    };
+
+    struct alignas(64) Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    struct LinuxDirent64 {
+        ino64_t d_ino;
+        off64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[];
+    };
+
+    Walker(unsigned threads, int maxDepth) : queues_(threads), maxDepth_(maxDepth) {}
+
+    bool take(unsigned self, Task& task) {
+        {
+            Queue& own = queues_[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t k = 1; k < queues_.size(); ++k) {
+            Queue& victim = queues_[(self + k) % queues_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template <typename Visit>
+    void run(unsigned self, Visit& visit) {
+        Task task;
+        while (pending_.load(std::memory_order_acquire) > 0) {
+            if (!take(self, task)) {
+                std::this_thread::yield();
+                continue;
+            }
+            scan(self, task, visit);
+            pending_.fetch_sub(1, std::memory_order_acq_rel);
+        }
+    }
+
+    void fail(const std::string& path) {
+        std::string message = "Could not read " + path + ": " + std::strerror(errno);
+        std::lock_guard<std::mutex> lock(errorMutex_);
+        errors_.push_back(std::move(message));
+    }
+
+    template <typename Visit>
+    void scan(unsigned self, const Task& task, Visit& visit) {
+        int fd = ::openat(AT_FDCWD, task.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            fail(task.path);
+            return;
+        }
+
+        alignas(LinuxDirent64) char buf[1 << 15];
+        std::vector<Task> subdirs;
+        for (;;) {
+            long n = ::syscall(SYS_getdents64, fd, buf, sizeof(buf));
+            if (n < 0) fail(task.path);
+            if (n <= 0) break;
+            for (long off = 0; off < n;) {
+                auto* d = reinterpret_cast<LinuxDirent64*>(buf + off);
+                off += d->d_reclen;
+                const char* name = d->d_name;
+                if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+
+                unsigned char type = d->d_type;
+                struct stat st;
+                if (type == DT_UNKNOWN) {
+                    if (::fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+                    type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG
+                         : S_ISLNK(st.st_mode) ? DT_LNK : DT_UNKNOWN;
+                }
+                if (type == DT_LNK) {
+                    // Symlinks count as files when they point to one, but
+                    // are never descended into, like recursive_directory_iterator
+                    if (::fstatat(fd, name, &st, 0) != 0 || !S_ISREG(st.st_mode)) continue;
+                    type = DT_REG;
+                }
+                if (type == DT_DIR) {
+                    if (maxDepth_ < 0 || task.depth < maxDepth_) {
+                        subdirs.push_back({task.path + "/" + name, task.depth + 1});
+                    }
+                } else if (type == DT_REG) {
+                    visit(self, WalkEntry{task.path, name, fd});
+                }
+            }
+        }
+        ::close(fd);
+
+        if (!subdirs.empty()) {
+            pending_.fetch_add(static_cast<long>(subdirs.size()), std::memory_order_acq_rel);
+            Queue& own = queues_[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            for (auto& sub : subdirs) own.tasks.push_back(std::move(sub));
+        }
+    }
+
+    std::vector<Queue> queues_;
+    std::atomic<long> pending_{0};
+    int maxDepth_;
+    std::mutex errorMutex_;
+    std::vector<std::string> errors_;
+};
+
+// Collect the paths of all regular files below root; directories that
+// could not be read are appended to `errors`
+inline std::vector<std::filesystem::path> listFiles(const std::filesystem::path& root, const WalkOptions& options,
+                                                    std::vector<std::string>& errors) {
+    std::vector<std::vector<std::filesystem::path>> perWorker(Walker::workers(options.threads));
+    std::vector<std::string> failed = Walker::walk(root, options, [&](unsigned worker, const WalkEntry& e) {
+        perWorker[worker].push_back(e.path());
+    });
+    errors.insert(errors.end(), failed.begin(), failed.end());
+    std::vector<std::filesystem::path> files;
+    for (auto& part : perWorker) {
+        files.insert(files.end(), std::make_move_iterator(part.begin()), std::make_move_iterator(part.end()));
+    }
+    return files;
+}
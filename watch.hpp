@@ -0,0 +1,152 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+// inotify watch on the organize_kif inbox and on setting.json. A file is
+// reported once nothing has happened to it for DEBOUNCE, so writers that
+// close and reopen a file are routed once, after their last write. The
+// settings file is watched through its directory, which also catches
+// editors that save by renaming a new file over the old one.
+
+struct WatchEvents {
+    std::vector<std::string> files;  // inbox names that settled
+    bool settingsChanged = false;
+    bool overflow = false;           // events were lost; rescan the inbox
+};
+
+class InboxWatcher {
+public:
+    static constexpr std::chrono::milliseconds DEBOUNCE{50};
+
+    InboxWatcher() = default;
+    InboxWatcher(const InboxWatcher&) = delete;
+    InboxWatcher& operator=(const InboxWatcher&) = delete;
+    ~InboxWatcher() {
+        if (fd_ >= 0) ::close(fd_);
+        if (inboxFd_ >= 0) ::close(inboxFd_);
+    }
+
+    bool open(const std::filesystem::path& inbox, const std::filesystem::path& settingFile, std::string& error) {
+        fd_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        inboxFd_ = ::open(inbox.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd_ < 0 || inboxFd_ < 0) {
+            error = "Could not watch " + inbox.string() + ": " + std::strerror(errno);
+            return false;
+        }
+        std::filesystem::path settingDir = settingFile.parent_path().empty() ? "." : settingFile.parent_path();
+        settingName_ = settingFile.filename().string();
+        inboxWd_ = ::inotify_add_watch(fd_, inbox.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR);
+        settingWd_ = ::inotify_add_watch(fd_, settingDir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR);
+        if (inboxWd_ < 0 || settingWd_ < 0) {
+            error = "inotify_add_watch failed: " + std::string(std::strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    // Block until some file settles, the settings change or events were
+    // lost. Returns false on a watch error; an interrupting signal returns
+    // true with no events so the caller can check its stop flag.
+    bool wait(WatchEvents& out, std::string& error) {
+        out = WatchEvents();
+        while (true) {
+            auto now = Clock::now();
+            collectDue(now, out);
+            if (!out.files.empty() || out.settingsChanged) return true;
+
+            int timeout = -1;
+            auto next = nextDeadline();
+            if (next != Clock::time_point::max()) {
+                auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count();
+                timeout = static_cast<int>(std::max<long long>(wait, 0) + 1);
+            }
+            struct pollfd pfd = {fd_, POLLIN, 0};
+            int ready = ::poll(&pfd, 1, timeout);
+            if (ready < 0) {
+                if (errno == EINTR) return true;
+                error = std::string("poll failed: ") + std::strerror(errno);
+                return false;
+            }
+            if (ready > 0 && !drain(out, error)) return false;
+            if (out.overflow) return true;
+        }
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Read all queued events, pushing back the deadline of every name seen
+    bool drain(WatchEvents& out, std::string& error) {
+        alignas(struct inotify_event) char buf[16384];
+        auto deadline = Clock::now() + DEBOUNCE;
+        while (true) {
+            ssize_t n = ::read(fd_, buf, sizeof(buf));
+            if (n < 0) {
+                if (errno == EAGAIN) return true;
+                if (errno == EINTR) continue;
+                error = std::string("inotify read failed: ") + std::strerror(errno);
+                return false;
+            }
+            for (char* p = buf; p < buf + n;) {
+                auto* ev = reinterpret_cast<struct inotify_event*>(p);
+                p += sizeof(struct inotify_event) + ev->len;
+                std::string name = ev->len ? ev->name : "";
+                if (ev->mask & IN_Q_OVERFLOW) {
+                    out.overflow = true;
+                } else if (ev->wd == inboxWd_ && (ev->mask & IN_IGNORED)) {
+                    error = "input folder was removed";
+                    return false;
+                } else if (ev->wd == inboxWd_ && !name.empty() && name[0] != '.') {
+                    pending_[name] = deadline;
+                } else if (ev->wd == settingWd_ && name == settingName_) {
+                    settingDeadline_ = deadline;
+                }
+            }
+        }
+    }
+
+    // Move settled names, still present as regular files, into `out`
+    void collectDue(Clock::time_point now, WatchEvents& out) {
+        for (auto it = pending_.begin(); it != pending_.end();) {
+            if (it->second > now) {
+                ++it;
+                continue;
+            }
+            struct stat st;
+            if (::fstatat(inboxFd_, it->first.c_str(), &st, 0) == 0 && S_ISREG(st.st_mode)) {
+                out.files.push_back(it->first);
+            }
+            it = pending_.erase(it);
+        }
+        if (settingDeadline_ <= now) {
+            out.settingsChanged = true;
+            settingDeadline_ = Clock::time_point::max();
+        }
+    }
+
+    Clock::time_point nextDeadline() const {
+        Clock::time_point next = settingDeadline_;
+        for (const auto& [name, deadline] : pending_) next = std::min(next, deadline);
+        return next;
+    }
+
+    int fd_ = -1;
+    int inboxFd_ = -1;
+    int inboxWd_ = -1;
+    int settingWd_ = -1;
+    std::string settingName_;
+    std::map<std::string, Clock::time_point> pending_;
+    Clock::time_point settingDeadline_ = Clock::time_point::max();
+};